@@ -0,0 +1,185 @@
+#ifndef ____BufferPool__
+#define ____BufferPool__
+
+#include <stdlib.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+#include "spsc-ring.h"
+
+/*
+ * Fixed pool of equally sized capture buffers.
+ *
+ * ALSA reads straight into a buffer taken from the pool, the buffer is handed
+ * to JS as an external Buffer and comes back here when V8 finalizes it
+ * (FreeCallback). If every buffer is still held by JS the pool falls back to a
+ * plain heap allocation and counts the event in `exhausted`.
+ *
+ * The pool is reference counted: the owning worker holds one reference and
+ * every acquired buffer holds another, so buffers that outlive the capture
+ * instance can still be returned safely.
+ *
+ * The free list is a SpscRing: acquire() and putBack() must only be called
+ * from the capture thread and release() only from the one thread the buffers
+ * are delivered to (the JS thread, or the writer thread of record).
+ */
+class BufferPool
+{
+public:
+    static const size_t alignment = 64;
+
+    BufferPool(size_t count, size_t size)
+        : count_(count), size_(align(size)), refs(1), exhausted_(0), free_(count)
+    {
+        spare_.reserve(count_);
+        void *slab = nullptr;
+        if (count_ > 0 && posix_memalign(&slab, alignment, count_ * size_) != 0)
+        {
+            throw std::bad_alloc();
+        }
+        slab_ = static_cast<char *>(slab);
+
+        for (size_t i = 0; i < count_; i++)
+        {
+            free_.push(slab_ + i * size_);
+        }
+    }
+
+    /* Drops the owner reference; the pool is deleted once all buffers are back. */
+    void destroy()
+    {
+        unref();
+    }
+
+    /* Returns a buffer of at least bufferSize() bytes; never fails. */
+    char *acquire()
+    {
+        refs.fetch_add(1, std::memory_order_relaxed);
+
+        char *buffer;
+        if (!spare_.empty())
+        {
+            buffer = spare_.back();
+            spare_.pop_back();
+            return buffer;
+        }
+        if (free_.pop(buffer))
+        {
+            return buffer;
+        }
+
+        exhausted_.fetch_add(1, std::memory_order_relaxed);
+
+        void *heap = nullptr;
+        if (posix_memalign(&heap, alignment, size_) != 0)
+        {
+            unref();
+            throw std::bad_alloc();
+        }
+        return static_cast<char *>(heap);
+    }
+
+    void release(char *buffer)
+    {
+        if (owns(buffer))
+        {
+            // cannot fail, the ring holds at least count_ entries
+            free_.push(buffer);
+        }
+        else
+        {
+            free(buffer);
+        }
+
+        unref();
+    }
+
+    /* Returns a buffer that was acquired but never handed to JS (capture thread). */
+    void putBack(char *buffer)
+    {
+        if (owns(buffer))
+        {
+            spare_.push_back(buffer);
+        }
+        else
+        {
+            free(buffer);
+        }
+
+        unref();
+    }
+
+    /* Nan::FreeCallback used for external Buffers backed by this pool */
+    static void FreeCallback(char *data, void *hint)
+    {
+        static_cast<BufferPool *>(hint)->release(data);
+    }
+
+    size_t bufferSize() const
+    {
+        return size_;
+    }
+
+    size_t size() const
+    {
+        return count_;
+    }
+
+    size_t available() const
+    {
+        return free_.size();
+    }
+
+    uint64_t exhausted() const
+    {
+        return exhausted_.load(std::memory_order_relaxed);
+    }
+
+    char *slab() const
+    {
+        return slab_;
+    }
+
+    size_t slabSize() const
+    {
+        return count_ * size_;
+    }
+
+private:
+    ~BufferPool()
+    {
+        free(slab_);
+    }
+
+    static size_t align(size_t size)
+    {
+        return ((size + alignment - 1) / alignment) * alignment;
+    }
+
+    bool owns(const char *buffer) const
+    {
+        return buffer >= slab_ && buffer < slab_ + count_ * size_;
+    }
+
+    void unref()
+    {
+        if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            delete this;
+        }
+    }
+
+    size_t count_;
+    size_t size_;
+    char *slab_;
+    std::atomic<long> refs;
+    std::atomic<uint64_t> exhausted_;
+    SpscRing<char *> free_;
+    // acquired buffers handed back by the capture thread itself
+    std::vector<char *> spare_;
+};
+
+#endif // ____BufferPool__
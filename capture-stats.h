@@ -0,0 +1,147 @@
+#ifndef ____CaptureStats__
+#define ____CaptureStats__
+
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+#include <cstddef>
+
+/* CLOCK_MONOTONIC in nanoseconds, the clock ALSA timestamps are taken from */
+inline int64_t monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Counters of the capture threads. Only ever incremented with relaxed atomics,
+ * so stats() can read them at any time without taking a lock.
+ */
+struct CaptureCounters
+{
+    CaptureCounters() : periods(0), frames(0), overruns(0), short_reads(0), read_errors(0), chunks_delivered(0), bytes_delivered(0) {}
+
+    static void add(std::atomic<uint64_t> &counter, uint64_t value = 1)
+    {
+        counter.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    static double get(const std::atomic<uint64_t> &counter)
+    {
+        return static_cast<double>(counter.load(std::memory_order_relaxed));
+    }
+
+    std::atomic<uint64_t> periods;
+    std::atomic<uint64_t> frames;
+    std::atomic<uint64_t> overruns;
+    std::atomic<uint64_t> short_reads;
+    std::atomic<uint64_t> read_errors;
+    // counted on the JS thread when the audio is dispatched
+    std::atomic<uint64_t> chunks_delivered;
+    std::atomic<uint64_t> bytes_delivered;
+};
+
+/*
+ * HDR style histogram of latencies in microseconds: exact below 32us, above
+ * that 32 linear sub-buckets per power of two (about 3% resolution) up to
+ * 2^36us. Recorded and read on the JS thread only.
+ */
+class LatencyHistogram
+{
+public:
+    static const int sub_bits = 5;
+    static const int sub_count = 1 << sub_bits;
+    static const int max_exponent = 36;
+    static const int bucket_count = (max_exponent - sub_bits + 2) * sub_count;
+
+    LatencyHistogram() : count(0), total(0), min(0), max(0)
+    {
+        for (int i = 0; i < bucket_count; i++)
+        {
+            buckets[i] = 0;
+        }
+    }
+
+    void record(int64_t micros)
+    {
+        uint64_t value = micros > 0 ? static_cast<uint64_t>(micros) : 0;
+
+        buckets[index(value)]++;
+        if (count == 0 || value < min)
+        {
+            min = value;
+        }
+        if (value > max)
+        {
+            max = value;
+        }
+        count++;
+        total += value;
+    }
+
+    /* smallest value (upper bound of its bucket) with at least fraction of the samples at or below it */
+    uint64_t percentile(double fraction) const
+    {
+        if (count == 0)
+        {
+            return 0;
+        }
+
+        uint64_t wanted = static_cast<uint64_t>(fraction * count + 0.5);
+        wanted = wanted < 1 ? 1 : wanted;
+
+        uint64_t seen = 0;
+        for (int i = 0; i < bucket_count; i++)
+        {
+            seen += buckets[i];
+            if (seen >= wanted)
+            {
+                uint64_t upper = upperBound(i);
+                return upper < max ? upper : max;
+            }
+        }
+        return max;
+    }
+
+    uint64_t count;
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+
+private:
+    static int index(uint64_t value)
+    {
+        if (value < static_cast<uint64_t>(sub_count))
+        {
+            return static_cast<int>(value);
+        }
+
+        int exponent = 63 - __builtin_clzll(value);
+        if (exponent > max_exponent)
+        {
+            return bucket_count - 1;
+        }
+
+        // the sub_bits below the leading one select the linear sub-bucket
+        int sub = static_cast<int>((value >> (exponent - sub_bits)) & (sub_count - 1));
+        return (exponent - sub_bits + 1) * sub_count + sub;
+    }
+
+    static uint64_t upperBound(int i)
+    {
+        if (i < sub_count)
+        {
+            return static_cast<uint64_t>(i);
+        }
+
+        int exponent = i / sub_count + sub_bits - 1;
+        uint64_t sub = static_cast<uint64_t>(i % sub_count);
+        uint64_t width = static_cast<uint64_t>(1) << (exponent - sub_bits);
+        return ((static_cast<uint64_t>(sub_count) + sub) * width) + width - 1;
+    }
+
+    uint64_t buckets[bucket_count];
+};
+
+#endif // ____CaptureStats__
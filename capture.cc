@@ -1,7 +1,14 @@
 #include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <climits>
+#include <cmath>
+#include <chrono>
+#include <memory>
 #include <string>
 #include <sstream>
 #include <thread>
+#include <vector>
 
 #define ALSA_PCM_NEW_HW_PARAMS_API
 
@@ -14,52 +21,174 @@ DISABLE_WCAST_FUNCTION_TYPE
 DISABLE_WCAST_FUNCTION_TYPE_END
 
 #include "streaming-worker.h"
+#include "channel-mix.h"
+#include "deinterleave.h"
+#include "device-probe.h"
+#include "history-ring.h"
+#include "level-meter.h"
+#include "recorder.h"
+#include "resampler.h"
+#include "shared-ring.h"
+#include "silence-gate.h"
+#include "pcm-device.h"
+#include "sample-convert.h"
+#include "shared-device.h"
+#include "thread-config.h"
+
+/* adaptive mode: bounds and history of the period/batch tuning of one device */
+struct AdaptiveState
+{
+    AdaptiveState() : min_frames(0), max_frames(0), last_change(0), last_trouble(0), stable_interval(0), overruns(0) {}
+
+    // bounds of the frames per "audio" event (period size * batch periods)
+    snd_pcm_uframes_t min_frames;
+    snd_pcm_uframes_t max_frames;
+    // monotonic ns
+    int64_t last_change;
+    int64_t last_trouble;
+    // how long things have to run smoothly before latency is lowered again; doubled by every overrun
+    int64_t stable_interval;
+    unsigned int overruns;
+};
+
+/* error recovery of one device: backoff between attempts, and what is being waited for */
+struct RecoveryState
+{
+    RecoveryState() : failures(0), retry_at(0), suspended(false), lost(false) {}
+
+    // consecutive errors, reset by the next successful read
+    unsigned int failures;
+    // monotonic ns of the next attempt, 0 while the device is running
+    int64_t retry_at;
+    // ESTRPIPE: waiting for snd_pcm_resume
+    bool suspended;
+    // closed, waiting to be opened again (reopen option)
+    bool lost;
+};
+
+/* Runtime state of one device of a capture */
+struct CaptureStream
+{
+    CaptureStream(const PcmConfig &config, int id)
+        : pcm(config), id(id), pool(NULL), buffer(NULL), batch_periods(1), base_batch_periods(1), capacity_periods(1), history(NULL), meter_position(0), pre_roll_frames(0), gate_closed_at(0), source(NULL), source_frames(0), forwarded(false), source_captured(0), source_delay(0), ring(0), position(0), started_at(0), latency_reported(false), out_rate(0), out_frames(0), out_period_bytes(0), out_channels(0), sample_bytes(0), plane_stride(0)
+    {
+        memset(&chunk, 0, sizeof(chunk));
+        chunk.meta.device = id;
+        chunk.sample_type = SAMPLE_OUTPUT_RAW;
+    }
+
+    PcmDevice pcm;
+    // index into the devices option, -1 for a single device capture
+    int id;
+    BufferPool *pool;
+    // buffer the current batch is read into
+    char *buffer;
+    AudioChunk chunk;
+    std::chrono::steady_clock::time_point batch_start;
+    unsigned int batch_periods;
+    // batch size asked for by deliveryInterval/minBatchFrames, and what the pool buffers have room for
+    unsigned int base_batch_periods;
+    unsigned int capacity_periods;
+    AdaptiveState adaptive;
+    RecoveryState recovery;
+    // historySeconds, owned by Capture
+    HistoryRing *history;
+    // levels: the meter, raw formats other than S16_LE converted to Float32 for it (and the gate), and the position its window started at
+    LevelMeter meter;
+    SampleConverter meter_converter;
+    std::vector<char> meter_input;
+    uint64_t meter_position;
+    // gate: the last preRoll frames (read back when the gate opens), planar ones interleaved in pre_roll_input, and where it last closed
+    SilenceGate gate;
+    std::unique_ptr<HistoryRing> pre_roll;
+    std::vector<char> pre_roll_input;
+    uint64_t pre_roll_frames;
+    uint64_t gate_closed_at;
+    // record: takes the batches instead of JS
+    std::unique_ptr<Recorder> recorder;
+    // shared device: as owner, the device subscribers attach to and the raw period they are all handed;
+    // as subscriber, the raw frames handed over, read instead of the device
+    std::shared_ptr<SharedDevice> shared_device;
+    std::vector<char> raw;
+    const char *source;
+    size_t source_frames;
+    // as subscriber, the timing the reader forwarded with the frames: captured (monotonic ns) and delay of the last one
+    bool forwarded;
+    int64_t source_captured;
+    snd_pcm_sframes_t source_delay;
+    // audio ring of the engine thread serving this device
+    size_t ring;
+    // frames read from the device so far
+    uint64_t position;
+    // monotonic ns of snd_pcm_start, for the "latency" event after the first period
+    int64_t started_at;
+    bool latency_reported;
+    // outputFormat conversion; rw access reads into scratch first
+    SampleConverter converter;
+    std::vector<char> scratch;
+    // channelMap/mix; reads into mix_input first
+    ChannelMixer mixer;
+    std::vector<char> mix_input;
+    // resample: Float32 frames are read into resample_input; for s16 the resampler writes to resample_output first
+    Resampler resampler;
+    SampleConverter resample_converter;
+    std::vector<char> resample_input;
+    std::vector<char> resample_output;
+    // rate of the frames delivered to JS and the most frames one period turns into
+    unsigned int out_rate;
+    size_t out_frames;
+    // size of a period, number of channels and bytes per sample as delivered to JS
+    size_t out_period_bytes;
+    size_t out_channels;
+    size_t sample_bytes;
+    // planar layout: one period in the output format before it is split into the channel planes
+    std::vector<char> interleaved;
+    size_t plane_stride;
+};
 
-class Capture : public StreamingWorker
+class Capture : public StreamingWorker, public DeviceSubscriber
 {
 public:
     Capture(Callback *data, Callback *complete, Callback *error_callback, v8::Local<v8::Object> &options)
         : StreamingWorker(data, complete, error_callback)
     {
-        channels = 2;
-        device = "default";
-        format = SND_PCM_FORMAT_S16_LE;
-        period_size = 32;
-        period_time = 0;
-        rate = 44100;
+        pool_size = 256;
+        delivery_interval = 0;
+        min_batch_frames = 0;
+        threads = 1;
+        has_devices = false;
+        adaptive = false;
+        reopen = false;
+        history_seconds = 0;
+        levels_interval = 0;
+        gate_enabled = false;
+        resampling = false;
+        recording = false;
+        shared_notify = false;
+        subscriber_stream = NULL;
+        subscriber_progress = NULL;
+        source_lost = false;
+        take_over = false;
+        resample_quality = RESAMPLE_MEDIUM;
+        output_rate = 0;
+        gate_threshold = -45;
+        gate_hangover = 500;
+        gate_pre_roll = 200;
+        gate_block = 10;
+        min_latency = 0;
+        max_latency = 100;
+        output_format = SAMPLE_OUTPUT_RAW;
+        planar = false;
 
         error_init = false;
         debug = false;
 
         if (options->IsObject())
         {
+            if (!parse_pcm_options(options, base_config))
             {
-                // v8::Local<v8::Value> channels_ = options->Get(New<v8::String>("channels").ToLocalChecked());
-                v8::Local<v8::Value> channels_ = Nan::Get(
-                                                     options,
-                                                     Nan::New("channels").ToLocalChecked())
-                                                     .ToLocalChecked();
-
-                if (!channels_->IsUndefined())
-                {
-                    bool channels_okay = true;
-
-                    if (channels_->IsNumber())
-                    {
-                        channels = Nan::To<int>(channels_).FromJust();
-                    }
-                    else
-                    {
-                        channels_okay = false;
-                    }
-
-                    if (!channels_okay || channels < 0)
-                    {
-                        error_init = true;
-                        Nan::ThrowError("channels has to be a positive number");
-                        return;
-                    }
-                }
+                error_init = true;
+                return;
             }
 
             {
@@ -83,375 +212,2856 @@ public:
                 }
             }
 
+            if (!get_int_option(options, "poolSize", pool_size, 1, INT_MAX,
+                                "poolSize has to be a number greater than 0") ||
+                !get_int_option(options, "deliveryInterval", delivery_interval, 0, INT_MAX,
+                                "deliveryInterval has to be a positive number") ||
+                !get_int_option(options, "minBatchFrames", min_batch_frames, 0, INT_MAX,
+                                "minBatchFrames has to be a positive number") ||
+                !get_int_option(options, "threads", threads, 1, 64,
+                                "threads has to be a value between 1 and 64"))
+            {
+                error_init = true;
+                return;
+            }
+
+            std::string output_format_name;
+            if (!get_string_option(options, "outputFormat", output_format_name, "outputFormat has to be a string"))
             {
-                // v8::Local<v8::Value> device_ = options->Get(New<v8::String>("device").ToLocalChecked());
-                v8::Local<v8::Value> device_ = Nan::Get(
-                                                   options,
-                                                   Nan::New("device").ToLocalChecked())
-                                                   .ToLocalChecked();
-                if (!device_->IsUndefined())
+                error_init = true;
+                return;
+            }
+            if (!output_format_name.empty())
+            {
+                if (output_format_name == "f32")
                 {
-                    if (device_->IsString())
-                    {
-                        // v8::Isolate *isolate = v8::Isolate::GetCurrent();
-                        // v8::String::Utf8Value deviceUTF8(isolate, device_);
-                        // device = std::string(*deviceUTF8);
-                        device = *Nan::Utf8String(device_);
-                    }
-                    else
-                    {
-                        error_init = true;
-                        Nan::ThrowError("device has to be a string");
-                        return;
-                    }
+                    output_format = SAMPLE_OUTPUT_F32;
+                }
+                else if (output_format_name == "s16")
+                {
+                    output_format = SAMPLE_OUTPUT_S16;
+                }
+                else
+                {
+                    error_init = true;
+                    Nan::ThrowError("outputFormat has to be f32 or s16");
+                    return;
                 }
             }
 
+            bool emit_audio = true;
+            if (!get_bool_option(options, "emitAudio", emit_audio, "emitAudio has to be a bool") ||
+                !get_int_option(options, "historySeconds", history_seconds, 0, 3600,
+                                "historySeconds has to be a value between 0 and 3600"))
             {
-                std::string format_name_;
-                // v8::Local<v8::Value> format_ = options->Get(New<v8::String>("format").ToLocalChecked());
-                v8::Local<v8::Value> format_ = Nan::Get(
-                                                   options,
-                                                   Nan::New("format").ToLocalChecked())
-                                                   .ToLocalChecked();
+                error_init = true;
+                return;
+            }
+            enableAudio(emit_audio);
 
-                if (!format_->IsUndefined())
-                {
-                    if (format_->IsString())
-                    {
-                        // v8::Isolate *isolate = v8::Isolate::GetCurrent();
-                        // v8::String::Utf8Value formatUTF8(isolate, format_);
-                        // format_name_ = std::string(*formatUTF8);
-                        format_name_ = *Nan::Utf8String(format_);
-                    }
-                    else
-                    {
-                        error_init = true;
-                        Nan::ThrowError("format has to be a string");
-                        return;
-                    }
+            bool levels = false;
+            int interval = 50;
+            if (!get_bool_option(options, "levels", levels, "levels has to be a bool") ||
+                !get_int_option(options, "levelsInterval", interval, 1, 60000,
+                                "levelsInterval has to be a value between 1 and 60000"))
+            {
+                error_init = true;
+                return;
+            }
+            levels_interval = levels ? interval : 0;
 
-                    bool found = false;
-                    std::string all_formats = "";
-                    for (int fn = 0; fn < SND_PCM_FORMAT_LAST; fn++)
-                    {
-                        auto format_enum = static_cast<_snd_pcm_format>(fn);
-                        const char *format_name = snd_pcm_format_name(format_enum);
-
-                        if (!format_name)
-                        {
-                            continue;
-                        }
-
-                        if (strcmp(format_name, format_name_.c_str()) == 0)
-                        {
-                            found = true;
-                            format = format_enum;
-                            break;
-                        }
-
-                        if (!(!snd_pcm_format_linear(format) &&
-                              !(format == SND_PCM_FORMAT_FLOAT_LE ||
-                                format == SND_PCM_FORMAT_FLOAT_BE)))
-                        {
-                            all_formats += std::string(format_name);
-                            all_formats += " ";
-                        }
-                    }
+            if (!parse_gate_option(options))
+            {
+                error_init = true;
+                return;
+            }
 
-                    if (!found)
-                    {
-                        error_init = true;
-                        auto error_msg = std::string("format not supported; supported: ");
-                        error_msg += all_formats;
-                        Nan::ThrowError(error_msg.c_str());
-                        return;
-                    }
+            std::string quality;
+            if (!get_string_option(options, "resample", quality, "resample has to be a string") ||
+                !get_int_option(options, "outputRate", output_rate, 1000, 768000,
+                                "outputRate has to be a value between 1000 and 768000"))
+            {
+                error_init = true;
+                return;
+            }
+            if (!quality.empty() && !resample::quality_from_name(quality, resample_quality))
+            {
+                error_init = true;
+                Nan::ThrowError("resample has to be one of fast, medium, best");
+                return;
+            }
+            resampling = !quality.empty() || output_rate > 0;
 
-                    if (!snd_pcm_format_linear(format) &&
-                        !(format == SND_PCM_FORMAT_FLOAT_LE ||
-                          format == SND_PCM_FORMAT_FLOAT_BE))
-                    {
-                        error_init = true;
-                        Nan::ThrowError("Invalid (non-linear/float) format");
-                        return;
-                    }
-                }
+            if (!parse_record_option(options) || !parse_shared_option(options))
+            {
+                error_init = true;
+                return;
             }
 
+            if (!get_bool_option(options, "reopen", reopen, "reopen has to be a bool") ||
+                !get_bool_option(options, "adaptive", adaptive, "adaptive has to be a bool") ||
+                !get_int_option(options, "minLatency", min_latency, 0, 60000,
+                                "minLatency has to be a value between 0 and 60000") ||
+                !get_int_option(options, "maxLatency", max_latency, 1, 60000,
+                                "maxLatency has to be a value between 1 and 60000"))
+            {
+                error_init = true;
+                return;
+            }
+            if (max_latency < min_latency)
             {
-                // v8::Local<v8::Value> period_size_ = options->Get(New<v8::String>("periodSize").ToLocalChecked());
-                v8::Local<v8::Value> period_size_ = Nan::Get(
-                                                        options,
-                                                        Nan::New("periodSize").ToLocalChecked())
-                                                        .ToLocalChecked();
+                error_init = true;
+                Nan::ThrowError("maxLatency has to be greater than minLatency");
+                return;
+            }
 
-                if (!period_size_->IsUndefined())
-                {
-                    bool period_size_okay = true;
+            int max_queued_frames = 0;
+            int max_queued_bytes = 0;
+            std::string queue_policy_name;
+            if (!get_int_option(options, "maxQueuedFrames", max_queued_frames, 0, INT_MAX,
+                                "maxQueuedFrames has to be a positive number") ||
+                !get_int_option(options, "maxQueuedBytes", max_queued_bytes, 0, INT_MAX,
+                                "maxQueuedBytes has to be a positive number") ||
+                !get_string_option(options, "queuePolicy", queue_policy_name, "queuePolicy has to be a string"))
+            {
+                error_init = true;
+                return;
+            }
 
-                    if (period_size_->IsNumber())
-                    {
-                        period_size = Nan::To<int>(period_size_).FromJust();
-                    }
-                    else
-                    {
-                        period_size_okay = false;
-                    }
+            QueuePolicy queue_policy = QUEUE_DROP_NEWEST;
+            if (queue_policy_name == "drop-oldest")
+            {
+                queue_policy = QUEUE_DROP_OLDEST;
+            }
+            else if (queue_policy_name == "block")
+            {
+                queue_policy = QUEUE_BLOCK;
+            }
+            else if (!queue_policy_name.empty() && queue_policy_name != "drop-newest")
+            {
+                error_init = true;
+                Nan::ThrowError("queuePolicy has to be one of drop-newest, drop-oldest, block");
+                return;
+            }
+            setQueueLimits(max_queued_frames, max_queued_bytes, queue_policy);
 
-                    if (!period_size_okay || period_size < 0)
-                    {
-                        error_init = true;
-                        Nan::ThrowError("period_size has to be a positive number");
-                        return;
-                    }
+            std::string layout;
+            if (!get_string_option(options, "layout", layout, "layout has to be a string"))
+            {
+                error_init = true;
+                return;
+            }
+            if (!layout.empty())
+            {
+                if (layout != "interleaved" && layout != "planar")
+                {
+                    error_init = true;
+                    Nan::ThrowError("layout has to be interleaved or planar");
+                    return;
                 }
+                planar = layout == "planar";
             }
 
+            if (!parse_thread_options(options) || !parse_devices_option(options))
             {
-                // v8::Local<v8::Value> period_time_ = options->Get(New<v8::String>("periodTime").ToLocalChecked());
-                v8::Local<v8::Value> period_time_ = Nan::Get(
-                                                        options,
-                                                        Nan::New("periodTime").ToLocalChecked())
-                                                        .ToLocalChecked();
+                error_init = true;
+                return;
+            }
+        }
 
-                if (!period_time_->IsUndefined())
-                {
-                    bool period_time_okay = true;
+        if (configs.empty())
+        {
+            configs.push_back(base_config);
+        }
 
-                    if (period_time_->IsNumber())
-                    {
-                        period_time = Nan::To<int>(period_time_).FromJust();
-                    }
-                    else
-                    {
-                        period_time_okay = false;
-                    }
+        if (options->IsObject() && !parse_channel_options(options))
+        {
+            error_init = true;
+            return;
+        }
 
-                    if (!period_time_okay || period_time < 0)
-                    {
-                        error_init = true;
-                        Nan::ThrowError("period_time has to be a positive number");
-                        return;
-                    }
+        /* the writer takes interleaved frames in a format its container can describe */
+        if (recording && planar)
+        {
+            error_init = true;
+            Nan::ThrowError("record needs the interleaved layout");
+            return;
+        }
+        if (recording && record_config.wav && output_format == SAMPLE_OUTPUT_RAW)
+        {
+            for (const PcmConfig &config : configs)
+            {
+                if (!Recorder::wavSupported(config.format))
+                {
+                    error_init = true;
+                    Nan::ThrowError("record with container wav needs U8, S16_LE, S24_3LE, S32_LE, FLOAT_LE or FLOAT64_LE");
+                    return;
                 }
             }
+        }
 
-            {
-                // v8::Local<v8::Value> rate_ = options->Get(New<v8::String>("rate").ToLocalChecked());
-                v8::Local<v8::Value> rate_ = Nan::Get(
-                                                 options,
-                                                 Nan::New("rate").ToLocalChecked())
-                                                 .ToLocalChecked();
-
-                if (!rate_->IsUndefined())
-                {
-                    bool rate_okay = true;
+        /* the ring has a single writer and describes one interleaved format in its header */
+        if (shared.active() && has_devices)
+        {
+            error_init = true;
+            Nan::ThrowError("sharedBuffer needs a single device");
+            return;
+        }
+        if (shared.active() && planar)
+        {
+            error_init = true;
+            Nan::ThrowError("sharedBuffer needs the interleaved layout");
+            return;
+        }
 
-                    if (rate_->IsNumber())
-                    {
-                        rate = Nan::To<int>(rate_).FromJust();
-                    }
-                    else
-                    {
-                        rate_okay = false;
-                    }
+        if (resampling && output_format == SAMPLE_OUTPUT_RAW)
+        {
+            error_init = true;
+            Nan::ThrowError("resample needs outputFormat f32 or s16");
+            return;
+        }
 
-                    if (!rate_okay || (rate < 4000 || rate > 384000))
-                    {
-                        error_init = true;
-                        Nan::ThrowError("rate has to be a value between 4000 and 384000");
-                        return;
-                    }
+        /* the meter and the gate read Float32 or S16, everything else has to be convertible */
+        if ((levels_interval > 0 || gate_enabled) && output_format == SAMPLE_OUTPUT_RAW)
+        {
+            for (const PcmConfig &config : configs)
+            {
+                if (snd_pcm_format_linear(config.format) != 1 && snd_pcm_format_float(config.format) != 1)
+                {
+                    error_init = true;
+                    Nan::ThrowError("levels and gate need a linear or float format");
+                    return;
                 }
             }
         }
 
-        // int size = (period_size * channels * snd_pcm_format_physical_width(format)) / 8;
+        /* adaptive mode starts at the smallest latency allowed and works its way up */
+        if (adaptive && min_latency > 0)
+        {
+            for (PcmConfig &config : configs)
+            {
+                config.period_size = std::max(16, min_latency * config.rate / 1000);
+                config.period_time = 0;
+            }
+        }
+        threads = std::min(threads, static_cast<int>(configs.size()));
+        histories.resize(configs.size());
+
+        // JS may fall behind by this many batches before audio is dropped
+        initAudioQueue(std::max(pool_size, 4096), threads);
 
-        // nothing needs to be here - just make sure you call base constructor
-        // The options parameter is for your JavaScript code to pass in
-        // an options object.  You can use this for whatever you want.
+        /* one eventfd per engine thread, polled next to its devices so close() and pause() act at once */
+        for (int t = 0; t < threads; t++)
+        {
+            wake_fds.push_back(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+        }
     }
 
     ~Capture()
     {
+        for (int fd : wake_fds)
+        {
+            if (fd >= 0)
+            {
+                ::close(fd);
+            }
+        }
+
+        shared_header.Reset();
+        atomics.Reset();
+        atomics_notify.Reset();
     }
 
-    void Execute(const AsyncProgressWorker::ExecutionProgress &progress)
+    void wake()
     {
-        int rc;
-        int size;
-        snd_pcm_t *handle;
-        snd_pcm_hw_params_t *params;
-        unsigned int val;
-        int dir;
-        snd_pcm_uframes_t frames;
+        uint64_t one = 1;
+        for (int fd : wake_fds)
+        {
+            if (fd >= 0 && write(fd, &one, sizeof(one)) < 0 && debug)
+            {
+                fprintf(stderr, "could not wake capture thread\n");
+            }
+        }
+    }
 
+    void Execute(const ExecutionProgress &progress)
+    {
         if (error_init)
         {
             return;
         }
 
-        rc = snd_pcm_open(&handle, device.c_str(), SND_PCM_STREAM_CAPTURE, 0);
+        /* Scheduling applies to the capture thread(s) only */
+        ThreadConfigResult thread_result;
+        apply_thread_config(thread_config, thread_result);
 
-        if (rc < 0)
+        bool multi = has_devices;
+        std::string first_error;
+        std::vector<std::unique_ptr<CaptureStream>> streams;
+
+        /* a single device capture attaches to a capture that has the device open already, or opens it for others to attach to */
+        std::shared_ptr<SharedDevice> owned;
+        while (!multi && !closed())
         {
-            std::ostringstream pcmDeviceError;
-            pcmDeviceError << "Unable to open PCM device: " << snd_strerror(rc) << "\n";
-            SetErrorMessage(pcmDeviceError.str().c_str());
-            return;
+            bool owner = false;
+            std::shared_ptr<SharedDevice> device = shared_device::registry().claim(configs[0], owner);
+            if (owner)
+            {
+                owned = device;
+                break;
+            }
+            // open with other parameters: this capture tries to open it on its own
+            if (!device)
+            {
+                break;
+            }
+            if (subscribe(progress, device))
+            {
+                return;
+            }
         }
 
-        /* Allocate a hardware parameters object. */
-        snd_pcm_hw_params_alloca(&params);
+        for (size_t i = 0; i < configs.size(); i++)
+        {
+            std::unique_ptr<CaptureStream> stream(new CaptureStream(configs[i], multi ? static_cast<int>(i) : -1));
+            stream->shared_device = owned;
 
-        /* Fill it in with default values. */
-        snd_pcm_hw_params_any(handle, params);
+            /* All handles are non-blocking and driven by poll() */
+            std::vector<Message> notices;
+            std::string error;
+            bool opened = stream->pcm.open(true, debug, notices, error);
 
-        /* Set the desired hardware parameters. */
+            for (Message &notice : notices)
+            {
+                notice.device = stream->id;
+                writeToNode(progress, notice);
+            }
 
-        /* Interleaved mode */
-        snd_pcm_hw_params_set_access(handle, params, SND_PCM_ACCESS_RW_INTERLEAVED);
+            if (!opened)
+            {
+                if (!multi)
+                {
+                    SetErrorMessage(error.c_str());
+                    closeShared(progress);
+                    releaseDevice(*stream, error);
+                    return;
+                }
 
-        /* Signed 16-bit little-endian format */
-        snd_pcm_hw_params_set_format(handle, params, format);
-        // snd_pcm_hw_params_set_format(handle, params, SND_PCM_FORMAT_S16_LE);
+                Message deviceError("deviceError", error, "");
+                deviceError.device = stream->id;
+                writeToNode(progress, deviceError);
 
-        /* Two channels (stereo) */
-        snd_pcm_hw_params_set_channels(handle, params, channels);
-        // snd_pcm_hw_params_set_channels(handle, params, 2);
+                if (first_error.empty())
+                {
+                    first_error = error;
+                }
+                continue;
+            }
 
-        /* 44100 bits/second sampling rate (CD quality) */
-        val = static_cast<unsigned int>(rate);
-        if (debug)
+            setupConversion(*stream);
+            setupBatching(*stream);
+            if (adaptive)
+            {
+                setupAdaptive(*stream);
+            }
+            if (history_seconds > 0)
+            {
+                setupHistory(*stream, i);
+            }
+            if (recording)
+            {
+                setupRecorder(progress, *stream);
+            }
+            if (shared.active() && !setupShared(*stream, error))
+            {
+                SetErrorMessage(error.c_str());
+                closeShared(progress);
+                stream->pcm.close();
+                releaseDevice(*stream, error);
+                return;
+            }
+            if (stream->shared_device)
+            {
+                stream->shared_device->opened(stream->pcm);
+            }
+            lock_thread_memory(thread_config, stream->pool->slab(), stream->pool->slabSize(), thread_result);
+            if (!stream->scratch.empty())
+            {
+                lock_thread_memory(thread_config, stream->scratch.data(), stream->scratch.size(), thread_result);
+            }
+            if (!stream->interleaved.empty())
+            {
+                lock_thread_memory(thread_config, stream->interleaved.data(), stream->interleaved.size(), thread_result);
+            }
+            streams.push_back(std::move(stream));
+        }
+
+        if (streams.empty())
+        {
+            SetErrorMessage(first_error.c_str());
+            return;
+        }
+
+        if (thread_config.requested())
+        {
+            reportThreadConfig(progress, thread_result);
+        }
+
+        /* Devices are spread round robin over the engine threads, each with its own audio ring */
+        size_t engine_count = std::min(static_cast<size_t>(threads), streams.size());
+        std::vector<std::vector<CaptureStream *>> groups(engine_count);
+        for (size_t i = 0; i < streams.size(); i++)
         {
-            fprintf(stderr, "Rate: %d\n", val);
+            streams[i]->ring = i % engine_count;
+            groups[i % engine_count].push_back(streams[i].get());
         }
-        snd_pcm_hw_params_set_rate_near(handle, params, &val, &dir);
 
-        frames = period_size;
-        snd_pcm_hw_params_set_period_size_near(handle, params, &frames, &dir);
+        std::vector<std::thread> engines;
+        for (size_t t = 1; t < engine_count; t++)
+        {
+            engines.emplace_back([this, &progress, &groups, t]() {
+                ThreadConfigResult result;
+                apply_thread_config(thread_config, result);
+                runEngine(progress, groups[t], wakeFd(t));
+            });
+        }
 
-        auto frames_time = static_cast<unsigned int>(period_time);
+        runEngine(progress, groups[0], wakeFd(0));
 
-        if (frames_time > 0)
+        for (std::thread &engine : engines)
         {
-            if (debug)
+            engine.join();
+        }
+
+        for (auto &stream : streams)
+        {
+            if (stream->buffer && stream->chunk.meta.periods > 0)
+            {
+                flushBatch(progress, *stream);
+            }
+            if (stream->buffer)
+            {
+                stream->pool->putBack(stream->buffer);
+                stream->buffer = NULL;
+            }
+            // a subscriber left takes the open device over before pcm.close() would close it
+            releaseDevice(*stream, "the device was lost");
+            stream->pcm.close();
+
+            // the last segment closes (and is reported) while progress is still valid
+            if (stream->recorder)
             {
-                fprintf(stderr, "Set period time near: %d\n", period_time);
+                stream->recorder->stop();
             }
-            snd_pcm_hw_params_set_period_time_near(handle, params, &frames_time, &dir);
         }
+        closeShared(progress);
+    }
 
-        /* Write the parameters to the driver */
-        rc = snd_pcm_hw_params(handle, params);
+private:
+    /* longest sleep in poll(); close() and pause() wake it early, adaptive mode is checked at least this often */
+    static const int poll_timeout = 50;
+
+    /* adaptive mode: minimum time between two changes, quiet time needed before lowering latency, in ns */
+    static const int64_t adapt_holdoff = 1000000000LL;
+    static const int64_t adapt_stable_initial = 10000000000LL;
+    static const int64_t adapt_stable_max = 600000000000LL;
+    /* events JS may fall behind before the batch grows; smallest period size tried */
+    static const unsigned int adapt_lag_events = 4;
+    static const snd_pcm_uframes_t adapt_min_period = 16;
+
+    /* wait before the first and longest wait between recovery attempts, in ns */
+    static const int64_t recover_backoff_min = 10000000LL;
+    static const int64_t recover_backoff_max = 5000000000LL;
+
+    /* sets up the outputFormat conversion, channelMap/mix and the layout of a freshly opened device */
+    void setupConversion(CaptureStream &stream)
+    {
+        PcmDevice &pcm = stream.pcm;
+        size_t channels = pcm.config.channels;
 
-        if (rc < 0)
+        /* the resampler works on Float32, whatever the output format */
+        stream.out_rate = pcm.actual_rate;
+        if (resampling)
         {
-            std::ostringstream hwError;
-            hwError << "Unable to set HW parameters: " << snd_strerror(rc) << "\n";
-            SetErrorMessage(hwError.str().c_str());
-            return;
+            stream.out_rate = output_rate > 0 ? output_rate : pcm.config.rate;
         }
+        bool resample = stream.out_rate != pcm.actual_rate;
+        SampleOutput work_format = resample ? SAMPLE_OUTPUT_F32 : output_format;
 
-        // auto sizeOld = frames * 4;
-        // fprintf(stderr, "Frames: %d; SizeOld: %d, SizeNew: %d\n", frames, sizeOld, size);
+        /* a mix sums Float32 samples and writes the requested output format itself */
+        if (!mix_matrix.empty())
+        {
+            stream.mixer = ChannelMixer::matrix(mix_matrix, channels, work_format);
+            stream.converter = SampleConverter(pcm.config.format, SAMPLE_OUTPUT_F32);
+        }
+        else
+        {
+            stream.converter = SampleConverter(pcm.config.format, work_format);
+        }
+        if (!channel_map.empty())
+        {
+            stream.mixer = ChannelMixer::selection(channel_map, channels, stream.converter.outputBytes());
+        }
 
-        unsigned int actualRate;
-        snd_pcm_hw_params_get_rate(params, &actualRate, &dir);
-        if (static_cast<unsigned int>(rate) != actualRate)
+        if (stream.mixer.active())
         {
-            if (debug)
-            {
-                fprintf(stderr, "Requested rate != actual rate: %d != %u\n", rate, actualRate);
-            }
-            Message rateDeviating("rateDeviating", std::to_string(actualRate), "");
-            writeToNode(progress, rateDeviating);
+            stream.mix_input.resize(pcm.frames * channels * stream.converter.outputBytes());
+            stream.out_channels = stream.mixer.outputChannels();
+            stream.sample_bytes = stream.mixer.outputBytes();
+        }
+        else
+        {
+            stream.out_channels = channels;
+            stream.sample_bytes = stream.converter.outputBytes();
         }
 
-        snd_pcm_hw_params_get_period_size(params, &frames, &dir);
-        if (frames != static_cast<unsigned long>(period_size))
+        stream.out_frames = pcm.frames;
+        stream.resampler = Resampler();
+        stream.resample_converter = SampleConverter();
+        if (resample)
         {
-            if (debug)
+            stream.resampler = Resampler(stream.out_channels, pcm.actual_rate, stream.out_rate, resample_quality, pcm.frames);
+            stream.out_frames = stream.resampler.maxOutput(pcm.frames);
+            stream.resample_input.resize(pcm.frames * stream.out_channels * sizeof(float));
+            if (output_format == SAMPLE_OUTPUT_S16)
             {
-                fprintf(stderr, "Requested period size != actual period size: %d != %lu\n", period_size, frames);
+                stream.resample_converter = SampleConverter(SND_PCM_FORMAT_FLOAT_LE, SAMPLE_OUTPUT_S16);
+                stream.resample_output.resize(stream.out_frames * stream.out_channels * sizeof(float));
+                stream.sample_bytes = sizeof(int16_t);
             }
-            Message periodSizeDeviating("periodSizeDeviating", std::to_string(frames), "");
-            writeToNode(progress, periodSizeDeviating);
         }
 
-        unsigned int actual_period_time;
-        snd_pcm_hw_params_get_period_time(params, &actual_period_time, &dir);
-        if (debug)
+        stream.chunk.sample_type = output_format;
+        stream.out_period_bytes = stream.out_frames * stream.out_channels * stream.sample_bytes;
+
+        /* mmap converts straight out of the DMA area, rw needs somewhere to read to */
+        if (stream.converter.active() && !pcm.mmap)
+        {
+            stream.scratch.resize(pcm.period_bytes);
+        }
+        if (stream.shared_device)
         {
-            fprintf(stderr, "Actual period time: %u\n", actual_period_time);
+            stream.raw.resize(pcm.period_bytes);
         }
-        Message periodTimeMessage("periodTime", std::to_string(actual_period_time), "");
-        writeToNode(progress, periodTimeMessage);
 
-        size = (frames * channels * snd_pcm_format_physical_width(format)) / 8;
+        if (planar)
+        {
+            stream.interleaved.resize(stream.out_period_bytes);
+        }
 
-        if (debug)
+        if (debug && stream.converter.active())
         {
-            fprintf(stderr, "Actual rate: %d\n", actualRate);
-            fprintf(stderr, "Buffer size: %d\n", size);
+            fprintf(stderr, "Conversion kernel: %s\n", stream.converter.kernelName());
+        }
+        if (debug && resample)
+        {
+            fprintf(stderr, "Resampling %u -> %u Hz, kernel: %s\n", pcm.actual_rate, stream.out_rate, stream.resampler.kernelName());
         }
 
-        char buffer[size];
-        while (!closed())
+        if (levels_interval > 0 || gate_enabled)
         {
-            rc = snd_pcm_readi(handle, buffer, frames);
-            if (rc == -EPIPE)
-            {
-                /* EPIPE means overrun */
-                if (debug)
-                {
-                    fprintf(stderr, "overrun occurred\n");
-                }
+            setupMeters(stream);
+        }
+    }
 
-                Message overrun("overrun", "overrun occurred", "");
-                writeToNode(progress, overrun);
+    /* the meter of levels and the gate, over the frames as they go to JS */
+    void setupMeters(CaptureStream &stream)
+    {
+        PcmDevice &pcm = stream.pcm;
+        SampleOutput input = output_format;
 
-                snd_pcm_prepare(handle);
-            }
-            else if (rc < 0)
+        stream.meter_converter = SampleConverter();
+        if (input == SAMPLE_OUTPUT_RAW)
+        {
+            if (pcm.config.format == SND_PCM_FORMAT_S16_LE)
             {
-                if (debug)
-                {
-                    fprintf(stderr, "Error from read: %s\n", snd_strerror(rc));
-                }
-
-                Message readError("readError", std::string(snd_strerror(rc)), "");
-                writeToNode(progress, readError);
+                input = SAMPLE_OUTPUT_S16;
             }
-            else if (rc != (int)frames)
+            else
+            {
+                input = SAMPLE_OUTPUT_F32;
+                stream.meter_converter = SampleConverter(pcm.config.format, SAMPLE_OUTPUT_F32);
+                stream.meter_input.resize(stream.out_frames * stream.out_channels * sizeof(float));
+            }
+        }
+
+        size_t rate = stream.out_rate;
+        if (levels_interval > 0)
+        {
+            size_t window = std::max<size_t>(1, rate * levels_interval / 1000);
+            stream.meter = LevelMeter(stream.out_channels, window, input);
+        }
+
+        /* the gate and its pre-roll keep their state (and frame numbering) when the device is opened again */
+        if (gate_enabled && !stream.gate.active())
+        {
+            size_t block = std::max<size_t>(1, rate * gate_block / 1000);
+            uint64_t hangover = static_cast<uint64_t>(rate) * gate_hangover / 1000;
+            stream.gate = SilenceGate(stream.out_channels, block, input, gate_threshold, hangover);
+
+            stream.pre_roll_frames = static_cast<uint64_t>(rate) * gate_pre_roll / 1000;
+            if (stream.pre_roll_frames > 0)
+            {
+                stream.pre_roll.reset(new HistoryRing(stream.pre_roll_frames, stream.out_frames, stream.out_channels * stream.sample_bytes));
+            }
+        }
+    }
+
+    /* picks the number of periods per "audio" event and creates the device's buffer pool */
+    void setupBatching(CaptureStream &stream)
+    {
+        snd_pcm_uframes_t frames = stream.out_frames;
+
+        /* Periods concatenated into one "audio" event; ALSA keeps reading at the hardware period */
+        unsigned int batch_periods = 1;
+        if (min_batch_frames > 0)
+        {
+            batch_periods = std::max(batch_periods, static_cast<unsigned int>((min_batch_frames + frames - 1) / frames));
+        }
+        if (delivery_interval > 0)
+        {
+            unsigned long interval_frames = static_cast<unsigned long>(delivery_interval) * stream.out_rate / 1000;
+            batch_periods = std::max(batch_periods, static_cast<unsigned int>((interval_frames + frames - 1) / frames));
+        }
+        stream.batch_periods = batch_periods;
+        stream.base_batch_periods = batch_periods;
+
+        /* adaptive mode may grow the batch later, up to maxLatency, without a new pool */
+        stream.capacity_periods = batch_periods;
+        if (adaptive)
+        {
+            unsigned long max_frames = static_cast<unsigned long>(max_latency) * stream.out_rate / 1000;
+            stream.capacity_periods = std::max(batch_periods, static_cast<unsigned int>(max_frames / frames));
+        }
+
+        if (debug)
+        {
+            fprintf(stderr, "Pool size: %d\n", pool_size);
+            fprintf(stderr, "Periods per batch: %u\n", batch_periods);
+        }
+
+        size_t buffer_size = stream.out_period_bytes * stream.capacity_periods;
+        if (planar)
+        {
+            /* one plane per channel, each starting on its own cache line */
+            size_t plane_bytes = stream.out_frames * stream.sample_bytes * stream.capacity_periods;
+            stream.plane_stride = (plane_bytes + 63) & ~static_cast<size_t>(63);
+            buffer_size = stream.plane_stride * stream.out_channels;
+
+            stream.chunk.planes = stream.out_channels;
+            stream.chunk.plane_stride = stream.plane_stride;
+        }
+
+        stream.pool = createPool(pool_size, buffer_size);
+
+        /* the pre-roll is read back interleaved, at most one buffer at a time */
+        if (stream.pre_roll && planar)
+        {
+            stream.pre_roll_input.resize(stream.out_period_bytes * stream.capacity_periods);
+        }
+        stream.chunk.pool = stream.pool;
+    }
+
+    /*
+     * one engine thread: waits on the poll descriptors of its devices and
+     * drains whichever are ready. wake_fd (the last descriptor) is signalled
+     * by close(), pause() and resume().
+     */
+    void runEngine(const ExecutionProgress &progress, std::vector<CaptureStream *> &group, int wake_fd)
+    {
+        std::vector<struct pollfd> fds;
+        std::vector<unsigned int> counts(group.size());
+        bool engine_paused = false;
+
+        for (CaptureStream *stream : group)
+        {
+            int rc = stream->pcm.start();
+            stream->started_at = monotonic_ns();
+            if (rc < 0)
+            {
+                recover(progress, *stream, rc);
+            }
+        }
+
+        while (!closed())
+        {
+            bool pause_requested = paused();
+            if (pause_requested != engine_paused)
+            {
+                for (CaptureStream *stream : group)
+                {
+                    pause_requested ? pauseStream(progress, *stream) : resumeStream(progress, *stream);
+                }
+                engine_paused = pause_requested;
+            }
+
+            /* devices waiting for a recovery attempt are left out of poll() until it is due */
+            int64_t now = monotonic_ns();
+            int timeout = poll_timeout;
+            bool alive = false;
+
+            fds.clear();
+            for (size_t i = 0; i < group.size(); i++)
+            {
+                CaptureStream &stream = *group[i];
+                counts[i] = 0;
+
+                if (engine_paused)
+                {
+                    alive = alive || stream.pcm.handle || stream.recovery.lost;
+                    continue;
+                }
+
+                if (stream.recovery.retry_at != 0 && now >= stream.recovery.retry_at)
+                {
+                    retryStream(progress, stream);
+                }
+                if (stream.recovery.retry_at != 0)
+                {
+                    int wait = static_cast<int>((stream.recovery.retry_at - now + 999999) / 1000000);
+                    timeout = std::max(0, std::min(timeout, wait));
+                    alive = true;
+                    continue;
+                }
+                if (!stream.pcm.handle)
+                {
+                    continue;
+                }
+
+                alive = true;
+                size_t before = fds.size();
+                stream.pcm.pollDescriptors(fds);
+                counts[i] = static_cast<unsigned int>(fds.size() - before);
+            }
+
+            /* every device of this thread is gone for good */
+            if (!alive)
+            {
+                break;
+            }
+
+            size_t device_fds = fds.size();
+            if (wake_fd >= 0)
+            {
+                struct pollfd wake = {wake_fd, POLLIN, 0};
+                fds.push_back(wake);
+                if (engine_paused)
+                {
+                    timeout = -1;
+                }
+            }
+
+            int ready = poll(fds.data(), fds.size(), timeout);
+
+            if (ready > 0 && fds.size() > device_fds && (fds[device_fds].revents & POLLIN))
+            {
+                uint64_t count;
+                if (read(wake_fd, &count, sizeof(count)) < 0 && debug)
+                {
+                    fprintf(stderr, "could not read wake event\n");
+                }
+            }
+
+            size_t offset = 0;
+            for (size_t i = 0; i < group.size(); i++)
+            {
+                unsigned short revents = ready > 0 ? group[i]->pcm.pollRevents(&fds[offset], counts[i]) : 0;
+                offset += counts[i];
+
+                if (revents & (POLLIN | POLLERR))
+                {
+                    readStream(progress, *group[i]);
+                }
+                if (adaptive && !engine_paused && group[i]->pcm.handle && group[i]->recovery.retry_at == 0)
+                {
+                    adapt(progress, *group[i]);
+                }
+            }
+        }
+    }
+
+    /* pause(): delivers what was read, then stops the device but keeps it configured and prepared */
+    void pauseStream(const ExecutionProgress &progress, CaptureStream &stream)
+    {
+        if (!stream.pcm.handle || stream.recovery.retry_at != 0)
+        {
+            return;
+        }
+
+        if (stream.chunk.meta.periods > 0)
+        {
+            flushBatch(progress, stream);
+        }
+
+        int rc = stream.pcm.stop();
+        if (rc < 0)
+        {
+            recover(progress, stream, rc);
+        }
+    }
+
+    /* resume(): only snd_pcm_start, the hw params are still in place */
+    void resumeStream(const ExecutionProgress &progress, CaptureStream &stream)
+    {
+        if (!stream.pcm.handle || stream.recovery.retry_at != 0)
+        {
+            return;
+        }
+
+        int rc = stream.pcm.start();
+        stream.started_at = monotonic_ns();
+        if (rc < 0)
+        {
+            recover(progress, stream, rc);
+        }
+    }
+
+    int wakeFd(size_t engine) const
+    {
+        return engine < wake_fds.size() ? wake_fds[engine] : -1;
+    }
+
+    /* reads every complete period the device has available */
+    void readStream(const ExecutionProgress &progress, CaptureStream &stream)
+    {
+        snd_pcm_t *handle = stream.pcm.handle;
+        snd_pcm_uframes_t frames = stream.pcm.frames;
+        AudioChunk &chunk = stream.chunk;
+
+        while (!closed())
+        {
+            snd_pcm_sframes_t rc = snd_pcm_avail_update(handle);
+            if (rc >= 0 && static_cast<snd_pcm_uframes_t>(rc) < frames)
+            {
+                return;
+            }
+
+            beginPeriod(stream);
+
+            size_t delivered = 0;
+            if (rc >= 0)
+            {
+                rc = readPeriod(stream, chunk.meta.frames, delivered);
+                if (rc == -EAGAIN)
+                {
+                    return;
+                }
+            }
+
+            /* nothing of a failed read is delivered; back to poll() (or a backoff) instead of retrying right away */
+            if (rc < 0)
+            {
+                recover(progress, stream, static_cast<int>(rc));
+                return;
+            }
+
+            if (rc != static_cast<snd_pcm_sframes_t>(frames))
             {
                 if (debug)
                 {
-                    fprintf(stderr, "Short read, read %d frames\n", rc);
+                    fprintf(stderr, "Short read, read %ld frames\n", rc);
+                }
+
+                CaptureCounters::add(counters.short_reads);
+                Message shortRead("shortRead", std::to_string(rc), "");
+                shortRead.device = stream.id;
+                writeToNode(progress, shortRead);
+            }
+
+            if (rc == 0)
+            {
+                return;
+            }
+
+            deliverPeriod(progress, stream, rc, delivered);
+        }
+    }
+
+    /* the buffer the next period is read into (ALSA or the converter write straight into what is handed to JS), and a new batch if none is open */
+    void beginPeriod(CaptureStream &stream)
+    {
+        AudioChunk &chunk = stream.chunk;
+        if (!stream.buffer)
+        {
+            stream.buffer = stream.pool->acquire();
+        }
+        if (chunk.meta.periods == 0)
+        {
+            chunk.meta.frames = 0;
+            chunk.meta.position = stream.position;
+            stream.batch_start = std::chrono::steady_clock::now();
+        }
+    }
+
+    /* history, meters and gate over a period just read (rc frames from the device, delivered in the output), then batching */
+    void deliverPeriod(const ExecutionProgress &progress, CaptureStream &stream, snd_pcm_sframes_t rc, size_t delivered)
+    {
+        AudioChunk &chunk = stream.chunk;
+
+        /* the frames just read, interleaved in the output format; with resample not as many as came from the device */
+        const char *frames_read = planar ? stream.interleaved.data()
+                                         : stream.buffer + stream.out_channels * stream.sample_bytes * chunk.meta.frames;
+        if (stream.history)
+        {
+            stream.history->write(frames_read, delivered);
+        }
+
+        SilenceGate::Event gate_event = SilenceGate::GATE_NONE;
+        if (stream.meter.active() || stream.gate.active())
+        {
+            /* the meters read Float32 or S16 */
+            const char *metered = frames_read;
+            size_t metered_bytes = stream.out_channels * stream.sample_bytes;
+            if (stream.meter_converter.active())
+            {
+                stream.meter_converter.convert(frames_read, stream.meter_input.data(), delivered * stream.out_channels);
+                metered = stream.meter_input.data();
+                metered_bytes = stream.out_channels * sizeof(float);
+            }
+
+            if (stream.meter.active())
+            {
+                meterFrames(progress, stream, metered, metered_bytes, delivered);
+            }
+            if (stream.gate.active())
+            {
+                gate_event = stream.gate.process(metered, delivered, metered_bytes, stream.position);
+            }
+        }
+        if (stream.pre_roll)
+        {
+            stream.pre_roll->write(frames_read, delivered);
+        }
+
+        CaptureCounters::add(counters.periods);
+        CaptureCounters::add(counters.frames, rc);
+        stream.position += delivered;
+        stream.recovery.failures = 0;
+
+        if (!stream.latency_reported)
+        {
+            reportLatency(progress, stream);
+        }
+
+        if (gate_event == SilenceGate::GATE_OPENED)
+        {
+            openGate(progress, stream, stream.position - delivered);
+        }
+        /* a closed gate delivers nothing, the next read goes to the same place */
+        else if (stream.gate.active() && !stream.gate.isOpen() && gate_event != SilenceGate::GATE_CLOSED)
+        {
+            return;
+        }
+
+        /* short reads add only the frames actually read, the next read continues right after them */
+        chunk.meta.periods++;
+        chunk.meta.frames += delivered;
+
+        if (chunk.meta.periods >= stream.batch_periods || gate_event == SilenceGate::GATE_CLOSED ||
+            (min_batch_frames > 0 && chunk.meta.frames >= static_cast<uint32_t>(min_batch_frames)) ||
+            (delivery_interval > 0 &&
+             std::chrono::steady_clock::now() - stream.batch_start >= std::chrono::milliseconds(delivery_interval)))
+        {
+            flushBatch(progress, stream);
+        }
+
+        if (gate_event == SilenceGate::GATE_CLOSED)
+        {
+            stream.gate_closed_at = stream.position;
+            Message gateClose("gateClose", "", "");
+            gateClose.device = stream.id;
+            gateClose.set("position", static_cast<double>(stream.position));
+            writeToNode(progress, gateClose);
+        }
+    }
+
+    /*
+     * after a failed read or avail update: an overrun restarts the device
+     * right away, a suspended device is resumed, anything else goes through
+     * snd_pcm_recover. Repeated errors back off exponentially, a device that
+     * cannot be recovered is closed (and opened again with reopen).
+     */
+    void recover(const ExecutionProgress &progress, CaptureStream &stream, int err)
+    {
+        RecoveryState &recovery = stream.recovery;
+
+        // the batch so far is continuous, what comes after the error is not
+        if (stream.chunk.meta.periods > 0)
+        {
+            flushBatch(progress, stream);
+        }
+
+        if (err == -EPIPE)
+        {
+            /* EPIPE means overrun */
+            if (debug)
+            {
+                fprintf(stderr, "overrun occurred\n");
+            }
+
+            CaptureCounters::add(counters.overruns);
+            stream.adaptive.overruns++;
+            Message overrun("overrun", "overrun occurred", "");
+            overrun.device = stream.id;
+            writeToNode(progress, overrun);
+
+            int rc = stream.pcm.start();
+            if (rc < 0)
+            {
+                backOff(stream);
+            }
+            return;
+        }
+
+        if (err == -ESTRPIPE)
+        {
+            if (debug)
+            {
+                fprintf(stderr, "device suspended\n");
+            }
+
+            Message suspended("suspended", "", "");
+            suspended.device = stream.id;
+            writeToNode(progress, suspended);
+
+            recovery.suspended = true;
+            recovery.failures = 0;
+            backOff(stream);
+            return;
+        }
+
+        if (debug)
+        {
+            fprintf(stderr, "Error from read: %s\n", snd_strerror(err));
+        }
+
+        CaptureCounters::add(counters.read_errors);
+        Message readError("readError", std::string(snd_strerror(err)), "");
+        readError.device = stream.id;
+        writeToNode(progress, readError);
+
+        int rc = stream.pcm.recover(err);
+        if (rc < 0)
+        {
+            lostStream(progress, stream, snd_strerror(rc));
+            return;
+        }
+
+        // the same error right after recovering: do not spin on it
+        if (recovery.failures > 0)
+        {
+            backOff(stream);
+        }
+        else
+        {
+            recovery.failures++;
+        }
+    }
+
+    /* schedules the next recovery attempt, doubling the wait with every failure */
+    void backOff(CaptureStream &stream)
+    {
+        RecoveryState &recovery = stream.recovery;
+        int64_t wait = recover_backoff_min << std::min(recovery.failures, 16u);
+
+        recovery.retry_at = monotonic_ns() + std::min(wait, recover_backoff_max);
+        recovery.failures++;
+    }
+
+    /* a due recovery attempt of runEngine: resume, reopen or restart the device */
+    void retryStream(const ExecutionProgress &progress, CaptureStream &stream)
+    {
+        RecoveryState &recovery = stream.recovery;
+        recovery.retry_at = 0;
+
+        if (recovery.lost)
+        {
+            std::string error;
+            if (!reopenStream(progress, stream, error))
+            {
+                backOff(stream);
+                return;
+            }
+
+            recovery.lost = false;
+            Message reopened("deviceReopened", "", "");
+            reopened.device = stream.id;
+            writeToNode(progress, reopened);
+            return;
+        }
+
+        int rc = recovery.suspended ? stream.pcm.resume() : stream.pcm.start();
+        if (rc == -EAGAIN)
+        {
+            backOff(stream);
+            return;
+        }
+        if (rc < 0)
+        {
+            lostStream(progress, stream, snd_strerror(rc));
+            return;
+        }
+
+        if (recovery.suspended)
+        {
+            recovery.suspended = false;
+            Message resumed("resumed", "", "");
+            resumed.device = stream.id;
+            writeToNode(progress, resumed);
+        }
+    }
+
+    /* the device is gone (unplugged, or failed to reopen): close it and, with reopen, keep trying to open it again */
+    void lostStream(const ExecutionProgress &progress, CaptureStream &stream, const std::string &error)
+    {
+        RecoveryState &recovery = stream.recovery;
+
+        if (debug)
+        {
+            fprintf(stderr, "device lost: %s\n", error.c_str());
+        }
+
+        if (stream.buffer && stream.chunk.meta.periods > 0)
+        {
+            flushBatch(progress, stream);
+        }
+        if (stream.buffer)
+        {
+            stream.pool->putBack(stream.buffer);
+            stream.buffer = NULL;
+        }
+        stream.pcm.close();
+
+        Message lost("deviceLost", error, "");
+        lost.device = stream.id;
+        writeToNode(progress, lost);
+
+        recovery.suspended = false;
+        recovery.retry_at = 0;
+        if (reopen)
+        {
+            recovery.lost = true;
+            recovery.failures = 0;
+            backOff(stream);
+        }
+    }
+
+    /*
+     * historySeconds of interleaved frames in the output format, kept for
+     * getHistory(). The guard leaves room for the largest write of the
+     * capture thread (adaptive mode may grow it), so readers rarely retry.
+     */
+    void setupHistory(CaptureStream &stream, size_t index)
+    {
+        size_t rate = stream.out_rate;
+        size_t guard = std::max(rate / 2, stream.out_frames * stream.capacity_periods);
+
+        HistoryRing *ring = new HistoryRing(history_seconds * rate, guard, stream.out_channels * stream.sample_bytes);
+        stream.history = ring;
+
+        std::lock_guard<std::mutex> locker(histories_mu);
+        histories[index].ring.reset(ring);
+        histories[index].sample_type = stream.chunk.sample_type;
+    }
+
+    /* record: the writer thread of a device, reporting through progress like the capture threads */
+    void setupRecorder(const ExecutionProgress &progress, CaptureStream &stream)
+    {
+        snd_pcm_format_t format = output_format == SAMPLE_OUTPUT_F32   ? SND_PCM_FORMAT_FLOAT_LE
+                                  : output_format == SAMPLE_OUTPUT_S16 ? SND_PCM_FORMAT_S16_LE
+                                                                       : stream.pcm.config.format;
+        int device = stream.id;
+
+        stream.recorder.reset(new Recorder(
+            record_config, device, format, stream.out_channels, pool_size,
+            [this, &progress, device](const RecordSegment &segment) {
+                Message closed("segmentClosed", "", "");
+                closed.device = device;
+                closed.setString("path", segment.path)
+                    .set("position", static_cast<double>(segment.position))
+                    .set("frames", static_cast<double>(segment.frames))
+                    .set("bytes", static_cast<double>(segment.bytes))
+                    .set("rate", segment.rate)
+                    .set("droppedFrames", static_cast<double>(segment.dropped));
+                writeToNode(progress, closed);
+            },
+            [this, &progress, device](const std::string &error) {
+                Message recordError("recordError", error, "");
+                recordError.device = device;
+                writeToNode(progress, recordError);
+            }));
+    }
+
+    /*
+     * shared device: this capture is handed the raw periods the capture that
+     * opened the device reads, on that capture's thread, and converts,
+     * batches and delivers them on its own. Its own thread only waits to be
+     * closed meanwhile. Returns false if the device was not open after all,
+     * so the caller claims it again.
+     */
+    bool subscribe(const ExecutionProgress &progress, const std::shared_ptr<SharedDevice> &device)
+    {
+        std::unique_ptr<CaptureStream> stream(new CaptureStream(configs[0], -1));
+
+        SharedDevice::State state = SharedDevice::OPENING;
+        while (state == SharedDevice::OPENING)
+        {
+            if (closed())
+            {
+                return true;
+            }
+            state = device->waitOpen(stream->pcm, poll_timeout);
+        }
+        if (state == SharedDevice::CLOSED)
+        {
+            return false;
+        }
+
+        /* feed() runs on the owner's thread, which must not wait for this capture's JS */
+        if (queue_policy.load(std::memory_order_relaxed) == QUEUE_BLOCK)
+        {
+            queue_policy.store(QUEUE_DROP_NEWEST, std::memory_order_relaxed);
+        }
+
+        std::string error;
+        setupConversion(*stream);
+        setupBatching(*stream);
+        if (history_seconds > 0)
+        {
+            setupHistory(*stream, 0);
+        }
+        if (recording)
+        {
+            setupRecorder(progress, *stream);
+        }
+        if (shared.active() && !setupShared(*stream, error))
+        {
+            SetErrorMessage(error.c_str());
+            closeShared(progress);
+            return true;
+        }
+        // there is no device of its own to time, the reader forwards its timing
+        stream->latency_reported = true;
+        stream->forwarded = true;
+
+        subscriber_stream = stream.get();
+        subscriber_progress = &progress;
+        source_lost = false;
+        if (!device->attach(this, stream->pcm.actual_rate))
+        {
+            subscriber_stream = NULL;
+            return false;
+        }
+
+        Message attached("deviceShared", configs[0].device, "");
+        writeToNode(progress, attached);
+
+        /* once the reader ends, the first subscriber left reads the device on from its own thread */
+        int wake_fd = wakeFd(0);
+        std::unique_ptr<PcmDevice> reading;
+        std::string lost_error;
+        while (!closed() && !source_lost)
+        {
+            if (take_over.exchange(false))
+            {
+                reading = device->adopt();
+                if (reading && !adoptDevice(*reading, *stream, lost_error))
+                {
+                    break;
+                }
+            }
+            if (reading)
+            {
+                if (!pumpDevice(progress, *device, *reading, stream->raw, wake_fd, lost_error))
+                {
+                    break;
+                }
+                continue;
+            }
+
+            struct pollfd fd = {wake_fd, POLLIN, 0};
+            if (poll(&fd, 1, poll_timeout) > 0)
+            {
+                uint64_t value;
+                if (read(wake_fd, &value, sizeof(value)) < 0 && debug)
+                {
+                    fprintf(stderr, "could not clear wake event\n");
+                }
+            }
+        }
+        device->detach(this);
+        subscriber_stream = NULL;
+
+        // chosen to read on while it was ending, the device goes on to the next one
+        if (take_over.exchange(false))
+        {
+            reading = device->adopt();
+        }
+        if (reading)
+        {
+            bool lost = !lost_error.empty();
+            releaseDevice(device, *reading, lost ? lost_error : "the device was lost", lost);
+            if (lost)
+            {
+                source_lost_reason = lost_error;
+                source_lost = true;
+            }
+        }
+
+        if (stream->buffer && stream->chunk.meta.periods > 0)
+        {
+            flushBatch(progress, *stream);
+        }
+        if (stream->buffer)
+        {
+            stream->pool->putBack(stream->buffer);
+            stream->buffer = NULL;
+        }
+        if (stream->recorder)
+        {
+            stream->recorder->stop();
+        }
+        closeShared(progress);
+
+        if (source_lost && !closed())
+        {
+            Message lost("deviceLost", source_lost_reason, "");
+            writeToNode(progress, lost);
+        }
+        return true;
+    }
+
+    /* shared device, subscriber: on the reader's thread, in pieces of at most the period size this capture was set up for */
+    void feed(const char *raw, size_t frames, int64_t captured, snd_pcm_sframes_t delay)
+    {
+        CaptureStream &stream = *subscriber_stream;
+        if (closed() || paused())
+        {
+            return;
+        }
+
+        while (frames > 0)
+        {
+            size_t n = std::min(frames, static_cast<size_t>(stream.pcm.frames));
+            // the timing is that of the last frame read, the frames behind this piece came later
+            size_t behind = frames - n;
+            stream.source = raw;
+            stream.source_frames = n;
+            stream.source_captured = captured - static_cast<int64_t>(behind) * 1000000000 / stream.pcm.actual_rate;
+            stream.source_delay = delay + static_cast<snd_pcm_sframes_t>(behind);
+
+            beginPeriod(stream);
+            size_t delivered = 0;
+            snd_pcm_sframes_t rc = readPeriod(stream, stream.chunk.meta.frames, delivered);
+            deliverPeriod(*subscriber_progress, stream, rc, delivered);
+
+            raw += n * stream.pcm.frame_bytes;
+            frames -= n;
+        }
+        stream.source = NULL;
+    }
+
+    /* shared device, subscriber: on the reader's thread; this capture's thread adopts the device */
+    void takeOver()
+    {
+        take_over = true;
+        wake();
+    }
+
+    /* shared device, subscriber: on the reader's thread; the capture ends with deviceLost */
+    void sourceLost(const std::string &reason)
+    {
+        source_lost_reason = reason;
+        source_lost = true;
+        wake();
+    }
+
+    /* shared device, subscriber: the device handed over, stopped if its reader was paused */
+    bool adoptDevice(PcmDevice &pcm, CaptureStream &stream, std::string &error)
+    {
+        if (debug)
+        {
+            fprintf(stderr, "Reading shared device %s from here on\n", pcm.config.device.c_str());
+        }
+
+        stream.raw.resize(pcm.period_bytes);
+        if (snd_pcm_state(pcm.handle) != SND_PCM_STATE_RUNNING)
+        {
+            int rc = pcm.start();
+            if (rc < 0)
+            {
+                error = snd_strerror(rc);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /*
+     * shared device, subscriber reading it: waits for the device (or a
+     * wake-up) once, then reads everything available and hands it to all
+     * subscribers, itself included. False with error set if the device
+     * could not be recovered.
+     */
+    bool pumpDevice(const ExecutionProgress &progress, SharedDevice &device, PcmDevice &pcm, std::vector<char> &raw, int wake_fd, std::string &error)
+    {
+        std::vector<struct pollfd> fds;
+        pcm.pollDescriptors(fds);
+        unsigned int device_fds = static_cast<unsigned int>(fds.size());
+        struct pollfd wake = {wake_fd, POLLIN, 0};
+        fds.push_back(wake);
+
+        int ready = poll(fds.data(), fds.size(), poll_timeout);
+        if (ready > 0 && (fds[device_fds].revents & POLLIN))
+        {
+            uint64_t value;
+            if (read(wake_fd, &value, sizeof(value)) < 0 && debug)
+            {
+                fprintf(stderr, "could not clear wake event\n");
+            }
+        }
+        if (ready <= 0 || !(pcm.pollRevents(fds.data(), device_fds) & (POLLIN | POLLERR)))
+        {
+            return true;
+        }
+
+        while (!closed())
+        {
+            snd_pcm_sframes_t rc = snd_pcm_avail_update(pcm.handle);
+            if (rc >= 0 && static_cast<snd_pcm_uframes_t>(rc) < pcm.frames)
+            {
+                return true;
+            }
+            if (rc >= 0)
+            {
+                rc = readRaw(pcm, raw.data());
+            }
+            if (rc == 0 || rc == -EAGAIN)
+            {
+                return true;
+            }
+            if (rc < 0)
+            {
+                if (rc == -EPIPE)
+                {
+                    CaptureCounters::add(counters.overruns);
+                    Message overrun("overrun", "overrun occurred", "");
+                    writeToNode(progress, overrun);
+                }
+                int err = pcm.recover(static_cast<int>(rc));
+                if (err < 0)
+                {
+                    error = snd_strerror(err);
+                    return false;
+                }
+                return true;
+            }
+            device.feed(raw.data(), rc, pcm.captureTime(), pcm.delay());
+        }
+        return true;
+    }
+
+    /*
+     * shared device, whoever reads it: stops reading pcm. Unless it was lost
+     * the first subscriber left reads on; otherwise pcm and the device are
+     * closed (the subscribers end with deviceLost) and others may open it.
+     */
+    void releaseDevice(const std::shared_ptr<SharedDevice> &device, PcmDevice &pcm, const std::string &reason, bool lost)
+    {
+        if (!lost && device->handOver(pcm))
+        {
+            return;
+        }
+        device->close(reason);
+        pcm.close();
+        shared_device::registry().remove(device);
+    }
+
+    /* shared device, owner: the device is handed over, or closed if it never opened or was lost */
+    void releaseDevice(CaptureStream &stream, const std::string &reason)
+    {
+        if (stream.shared_device)
+        {
+            releaseDevice(stream.shared_device, stream.pcm, reason, false);
+            stream.shared_device.reset();
+        }
+    }
+
+    /* reads one period of raw frames into raw, via snd_pcm_readi or out of the mmap area */
+    static snd_pcm_sframes_t readRaw(PcmDevice &pcm, char *raw)
+    {
+        return pcm.mmap ? pcm.readMapped(pcm.frames, [raw, &pcm](const char *src, snd_pcm_uframes_t offset, snd_pcm_uframes_t n) {
+            memcpy(raw + offset * pcm.frame_bytes, src, n * pcm.frame_bytes);
+        })
+                        : pcm.read(raw, pcm.frames);
+    }
+
+    /* sharedBuffer: the format goes into the header; a batch that can never fit would only ever be dropped */
+    bool setupShared(CaptureStream &stream, std::string &error)
+    {
+        size_t frame_bytes = stream.out_channels * stream.sample_bytes;
+        shared.configure(frame_bytes, stream.out_rate, stream.out_channels, stream.chunk.sample_type);
+
+        size_t batch = stream.out_period_bytes * stream.base_batch_periods;
+        if (batch > shared.room())
+        {
+            std::ostringstream message;
+            message << "sharedBuffer is too small for one batch, it needs at least "
+                    << SharedRing::header_bytes + batch + frame_bytes << " bytes";
+            error = message.str();
+            return false;
+        }
+        return true;
+    }
+
+    /* sharedBuffer: STATE closed, and a consumer blocked in Atomics.wait woken to see it */
+    void closeShared(const ExecutionProgress &progress)
+    {
+        if (shared.active())
+        {
+            shared.close();
+            shared_notify = true;
+            progress.Signal();
+        }
+    }
+
+    /* Atomics.notify() on WRITE: V8 can only wake Atomics.wait from JS, so the capture thread asks for it through the drain */
+    void drained()
+    {
+        if (!shared_notify.exchange(false))
+        {
+            return;
+        }
+
+        v8::Local<v8::Value> argv[] = {
+            Nan::New(shared_header),
+            Nan::New<v8::Number>(SharedRing::SLOT_WRITE)};
+        Nan::Call(Nan::New(atomics_notify), Nan::New(atomics), 2, argv);
+    }
+
+    v8::Local<v8::Value> history(double from, double to, int device)
+    {
+        std::lock_guard<std::mutex> locker(histories_mu);
+        if (device < 0 || static_cast<size_t>(device) >= histories.size() || !histories[device].ring)
+        {
+            return Nan::Undefined();
+        }
+
+        HistoryRing &ring = *histories[device].ring;
+        uint64_t oldest, newest;
+        ring.range(oldest, newest);
+
+        // the negated comparisons also catch NaN
+        uint64_t first = !(from > static_cast<double>(oldest)) ? oldest : from < static_cast<double>(newest) ? static_cast<uint64_t>(from) : newest;
+        uint64_t last = !(to >= 0) || !(to < static_cast<double>(newest)) ? newest : static_cast<uint64_t>(to);
+        last = std::max(first, last);
+
+        size_t size = static_cast<size_t>(last - first) * ring.frameBytes();
+        char *data = static_cast<char *>(malloc(std::max<size_t>(size, 1)));
+        ring.read(first, last, data);
+        size = static_cast<size_t>(last - first) * ring.frameBytes();
+
+        v8::Local<v8::Object> buffer = Nan::NewBuffer(data, size, free_history, NULL).ToLocalChecked();
+        v8::Local<v8::Object> result = Nan::New<v8::Object>();
+        Nan::Set(result, Nan::New("data").ToLocalChecked(), sampleView(buffer, 0, size, histories[device].sample_type));
+        Nan::Set(result, Nan::New("from").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(first)));
+        Nan::Set(result, Nan::New("to").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(last)));
+        return result;
+    }
+
+    static void free_history(char *data, void *hint)
+    {
+        free(data);
+    }
+
+    /* feeds the meter, emitting "levels" for every window completed */
+    void meterFrames(const ExecutionProgress &progress, CaptureStream &stream, const char *data, size_t frame_bytes, size_t frames)
+    {
+        uint64_t position = stream.position;
+        while (frames > 0)
+        {
+            if (stream.meter.frames() == 0)
+            {
+                stream.meter_position = position;
+            }
+
+            size_t n = stream.meter.add(data, frames);
+            data += n * frame_bytes;
+            frames -= n;
+            position += n;
+
+            if (stream.meter.complete())
+            {
+                std::vector<double> rms, peak, clipped;
+                stream.meter.take(rms, peak, clipped);
+
+                Message levels("levels", "", "");
+                levels.device = stream.id;
+                levels.setArray("rms", rms)
+                    .setArray("peak", peak)
+                    .setArray("clipped", clipped)
+                    .set("position", static_cast<double>(stream.meter_position))
+                    .set("frames", static_cast<double>(position - stream.meter_position));
+                writeToNode(progress, levels);
+            }
+        }
+    }
+
+    /*
+     * The gate opened on the read starting at end, which is in stream.buffer
+     * and not yet counted in the batch. The pre-roll before it goes out
+     * first, as audio events of its own: up to preRoll frames before the
+     * block that opened the gate, without anything delivered before the gate
+     * last closed.
+     */
+    void openGate(const ExecutionProgress &progress, CaptureStream &stream, uint64_t end)
+    {
+        uint64_t trigger = stream.gate.trigger();
+        uint64_t from = end;
+        if (stream.pre_roll)
+        {
+            uint64_t oldest, newest;
+            stream.pre_roll->range(oldest, newest);
+            from = trigger > stream.pre_roll_frames ? trigger - stream.pre_roll_frames : 0;
+            from = std::min(end, std::max(from, std::max(oldest, stream.gate_closed_at)));
+        }
+
+        Message gateOpen("gateOpen", "", "");
+        gateOpen.device = stream.id;
+        gateOpen.set("position", static_cast<double>(from)).set("trigger", static_cast<double>(trigger));
+        writeToNode(progress, gateOpen);
+
+        AudioChunk &chunk = stream.chunk;
+        char *current = stream.buffer;
+        uint64_t capacity = static_cast<uint64_t>(stream.out_frames) * stream.capacity_periods;
+
+        while (from < end)
+        {
+            uint64_t to = std::min(end, from + capacity);
+            stream.buffer = stream.pool->acquire();
+
+            // only this thread writes the pre-roll, so the range always reads back whole
+            char *dst = planar ? stream.pre_roll_input.data() : stream.buffer;
+            stream.pre_roll->read(from, to, dst);
+            if (to > from)
+            {
+                if (planar)
+                {
+                    deinterleave_frames(dst, stream.buffer, static_cast<size_t>(to - from), stream.out_channels,
+                                        stream.sample_bytes, stream.plane_stride);
+                }
+                chunk.meta.periods = 1;
+                chunk.meta.frames = static_cast<uint32_t>(to - from);
+                chunk.meta.position = from;
+                flushBatch(progress, stream);
+            }
+            if (stream.buffer)
+            {
+                stream.pool->putBack(stream.buffer);
+            }
+            from = to > from ? to : end;
+        }
+
+        stream.buffer = current;
+        chunk.meta.periods = 0;
+        chunk.meta.frames = 0;
+        chunk.meta.position = end;
+    }
+
+    /* bounds of the adaptive tuning, once the device told its actual rate */
+    void setupAdaptive(CaptureStream &stream)
+    {
+        AdaptiveState &state = stream.adaptive;
+        unsigned int rate = stream.pcm.actual_rate;
+
+        state.min_frames = min_latency > 0 ? static_cast<snd_pcm_uframes_t>(min_latency) * rate / 1000
+                                           : stream.pcm.frames * stream.batch_periods;
+        state.max_frames = std::max(state.min_frames, static_cast<snd_pcm_uframes_t>(max_latency) * rate / 1000);
+        state.stable_interval = adapt_stable_initial;
+        state.last_change = monotonic_ns();
+        state.last_trouble = state.last_change;
+    }
+
+    /*
+     * adaptive mode, called after every poll(): overruns double the period
+     * size (renegotiating the hw params), JS falling behind doubles the batch,
+     * and a long enough quiet time halves the batch, then the period size.
+     */
+    void adapt(const ExecutionProgress &progress, CaptureStream &stream)
+    {
+        AdaptiveState &state = stream.adaptive;
+        int64_t now = monotonic_ns();
+
+        if (now - state.last_change < adapt_holdoff)
+        {
+            state.overruns = 0;
+            return;
+        }
+
+        snd_pcm_uframes_t frames = stream.pcm.frames;
+        unsigned int batch = stream.batch_periods;
+
+        if (state.overruns > 0)
+        {
+            state.overruns = 0;
+            state.last_trouble = now;
+            state.stable_interval = std::min(state.stable_interval * 2, adapt_stable_max);
+
+            /* larger periods leave the capture thread more time per wake up */
+            if (frames * 2 * batch <= state.max_frames)
+            {
+                reconfigure(progress, stream, frames * 2, "overrun");
+            }
+            return;
+        }
+
+        /* JS is more than a few events behind: fewer, larger events */
+        uint64_t queued = queued_frames.load(std::memory_order_relaxed);
+        if (queued > adapt_lag_events * frames * batch)
+        {
+            state.last_trouble = now;
+            if (frames * batch * 2 <= state.max_frames && batch * 2 <= stream.capacity_periods)
+            {
+                setBatchPeriods(progress, stream, batch * 2, "lag");
+            }
+            return;
+        }
+
+        if (now - state.last_trouble < state.stable_interval || now - state.last_change < state.stable_interval)
+        {
+            return;
+        }
+
+        if (batch > stream.base_batch_periods && frames * (batch / 2) >= state.min_frames)
+        {
+            setBatchPeriods(progress, stream, std::max(batch / 2, stream.base_batch_periods), "stable");
+        }
+        else if (frames / 2 >= adapt_min_period && (frames / 2) * batch >= state.min_frames)
+        {
+            reconfigure(progress, stream, frames / 2, "stable");
+        }
+        else
+        {
+            // nothing left to lower, check again after another stable interval
+            state.last_change = now;
+        }
+    }
+
+    void setBatchPeriods(const ExecutionProgress &progress, CaptureStream &stream, unsigned int batch, const char *reason)
+    {
+        if (stream.chunk.meta.periods > 0)
+        {
+            flushBatch(progress, stream);
+        }
+        stream.batch_periods = batch;
+        stream.adaptive.last_change = monotonic_ns();
+        reportAdapted(progress, stream, reason);
+    }
+
+    /* reopens the device with another period size */
+    bool reconfigure(const ExecutionProgress &progress, CaptureStream &stream, snd_pcm_uframes_t frames, const char *reason)
+    {
+        // the pending batch still has the old period size
+        if (stream.buffer && stream.chunk.meta.periods > 0)
+        {
+            flushBatch(progress, stream);
+        }
+        if (stream.buffer)
+        {
+            stream.pool->putBack(stream.buffer);
+            stream.buffer = NULL;
+        }
+
+        stream.pcm.close();
+        stream.pcm.config.period_size = static_cast<int>(frames);
+        stream.pcm.config.period_time = 0;
+
+        std::string error;
+        if (!reopenStream(progress, stream, error))
+        {
+            lostStream(progress, stream, error);
+            return false;
+        }
+
+        stream.adaptive.last_change = stream.started_at;
+        reportAdapted(progress, stream, reason);
+        return true;
+    }
+
+    /* opens and starts the closed device of stream again; buffers and pool are set up anew as the granted parameters may differ */
+    bool reopenStream(const ExecutionProgress &progress, CaptureStream &stream, std::string &error)
+    {
+        std::vector<Message> notices;
+        bool opened = stream.pcm.open(true, debug, notices, error);
+
+        for (Message &notice : notices)
+        {
+            notice.device = stream.id;
+            writeToNode(progress, notice);
+        }
+
+        if (!opened)
+        {
+            return false;
+        }
+
+        BufferPool *old_pool = stream.pool;
+        setupConversion(stream);
+        setupBatching(stream);
+        retirePool(old_pool);
+        if (shared.active() && !setupShared(stream, error))
+        {
+            stream.pcm.close();
+            return false;
+        }
+        if (stream.shared_device)
+        {
+            stream.shared_device->opened(stream.pcm);
+        }
+
+        ThreadConfigResult result;
+        lock_thread_memory(thread_config, stream.pool->slab(), stream.pool->slabSize(), result);
+
+        int rc = stream.pcm.start();
+        if (rc < 0)
+        {
+            error = snd_strerror(rc);
+            stream.pcm.close();
+            return false;
+        }
+
+        stream.started_at = monotonic_ns();
+        stream.latency_reported = false;
+        return true;
+    }
+
+    /* the "adapted" event with the settings now in use */
+    void reportAdapted(const ExecutionProgress &progress, CaptureStream &stream, const char *reason)
+    {
+        PcmDevice &pcm = stream.pcm;
+        double period_time = 1000.0 * pcm.frames / pcm.actual_rate;
+
+        Message adapted("adapted", "", "");
+        adapted.device = stream.id;
+        adapted.setString("reason", reason)
+            .set("periodSize", pcm.frames)
+            .set("batchPeriods", stream.batch_periods)
+            .set("periodTime", period_time)
+            .set("latency", period_time * stream.batch_periods);
+
+        if (debug)
+        {
+            fprintf(stderr, "Adapted (%s): period size %lu, %u periods per batch\n", reason, pcm.frames, stream.batch_periods);
+        }
+
+        writeToNode(progress, adapted);
+    }
+
+    /*
+     * reads one period into the stream's buffer, offset frames into the
+     * batch, in the configured layout; returns the frames read from the
+     * device, delivered receives the frames written to the buffer
+     */
+    snd_pcm_sframes_t readPeriod(CaptureStream &stream, size_t offset, size_t &delivered)
+    {
+        char *dst = planar ? stream.interleaved.data() : stream.buffer + stream.out_channels * stream.sample_bytes * offset;
+
+        snd_pcm_sframes_t rc;
+        if (stream.resampler.active())
+        {
+            rc = readResampled(stream, dst, delivered);
+        }
+        else
+        {
+            rc = readInterleaved(stream, dst);
+            delivered = rc > 0 ? rc : 0;
+        }
+
+        if (planar && delivered > 0)
+        {
+            deinterleave_frames(stream.interleaved.data(), stream.buffer + stream.sample_bytes * offset,
+                                delivered, stream.out_channels, stream.sample_bytes, stream.plane_stride);
+        }
+        return rc;
+    }
+
+    /* reads one period as Float32 and resamples it to the output rate into dst */
+    snd_pcm_sframes_t readResampled(CaptureStream &stream, char *dst, size_t &delivered)
+    {
+        delivered = 0;
+        snd_pcm_sframes_t rc = readInterleaved(stream, stream.resample_input.data());
+        if (rc <= 0)
+        {
+            return rc;
+        }
+
+        const float *in = reinterpret_cast<const float *>(stream.resample_input.data());
+        if (!stream.resample_converter.active())
+        {
+            delivered = stream.resampler.process(in, rc, reinterpret_cast<float *>(dst));
+            return rc;
+        }
+
+        delivered = stream.resampler.process(in, rc, reinterpret_cast<float *>(stream.resample_output.data()));
+        stream.resample_converter.convert(stream.resample_output.data(), dst, delivered * stream.out_channels);
+        return rc;
+    }
+
+    /* reads one period into dst as interleaved frames of the channels going to JS */
+    snd_pcm_sframes_t readInterleaved(CaptureStream &stream, char *dst)
+    {
+        if (!stream.mixer.active())
+        {
+            return readConverted(stream, dst);
+        }
+
+        snd_pcm_sframes_t rc = readConverted(stream, stream.mix_input.data());
+        if (rc > 0)
+        {
+            stream.mixer.process(stream.mix_input.data(), dst, rc);
+        }
+        return rc;
+    }
+
+    /* reads one period into dst, via snd_pcm_readi or straight out of the mmap area, converting on the way */
+    snd_pcm_sframes_t readConverted(CaptureStream &stream, char *dst)
+    {
+        PcmDevice &pcm = stream.pcm;
+        const SampleConverter &converter = stream.converter;
+        size_t channels = pcm.config.channels;
+
+        /* a subscriber converts the raw frames the owner of the device handed over */
+        if (stream.source)
+        {
+            convertRaw(stream, stream.source, stream.source_frames, dst);
+            return static_cast<snd_pcm_sframes_t>(stream.source_frames);
+        }
+
+        /* with subscribers the device is read once into raw, which all of them and this capture convert from */
+        if (stream.shared_device && stream.shared_device->subscribed())
+        {
+            char *raw = stream.raw.data();
+            snd_pcm_sframes_t rc = readRaw(pcm, raw);
+            if (rc > 0)
+            {
+                stream.shared_device->feed(raw, rc, pcm.captureTime(), pcm.delay());
+                convertRaw(stream, raw, rc, dst);
+            }
+            return rc;
+        }
+
+        if (!pcm.mmap)
+        {
+            if (!converter.active())
+            {
+                return pcm.read(dst, pcm.frames);
+            }
+
+            snd_pcm_sframes_t rc = pcm.read(stream.scratch.data(), pcm.frames);
+            if (rc > 0)
+            {
+                converter.convert(stream.scratch.data(), dst, rc * channels);
+            }
+            return rc;
+        }
+
+        size_t frame_bytes = pcm.frame_bytes;
+        size_t out_frame_bytes = channels * converter.outputBytes();
+        return pcm.readMapped(pcm.frames, [&converter, dst, channels, frame_bytes, out_frame_bytes](const char *src, snd_pcm_uframes_t offset, snd_pcm_uframes_t n) {
+            if (converter.active())
+            {
+                converter.convert(src, dst + offset * out_frame_bytes, n * channels);
+            }
+            else
+            {
+                memcpy(dst + offset * frame_bytes, src, n * frame_bytes);
+            }
+        });
+    }
+
+    void convertRaw(CaptureStream &stream, const char *raw, size_t frames, char *dst)
+    {
+        if (stream.converter.active())
+        {
+            stream.converter.convert(raw, dst, frames * stream.pcm.config.channels);
+        }
+        else
+        {
+            memcpy(dst, raw, frames * stream.pcm.frame_bytes);
+        }
+    }
+
+    /* hands the batch of stream to JS; keeps (and reuses) the buffer if the queue is full, audio is off or it went to sharedBuffer */
+    bool flushBatch(const ExecutionProgress &progress, CaptureStream &stream)
+    {
+        AudioChunk &chunk = stream.chunk;
+        if (!audioEnabled() && !stream.recorder)
+        {
+            chunk.meta.periods = 0;
+            return false;
+        }
+
+        chunk.buffer = stream.buffer;
+        /* a subscriber has no handle of its own, the reader of the device forwards its timing */
+        chunk.captured = stream.forwarded ? stream.source_captured : stream.pcm.captureTime();
+        chunk.meta.timestamp = chunk.captured - static_cast<int64_t>(stream.position - chunk.meta.position) * 1000000000 / stream.out_rate -
+                               static_cast<int64_t>(stream.resampler.delay()) * 1000000000 / stream.pcm.actual_rate;
+        chunk.meta.delay = stream.forwarded ? stream.source_delay : stream.pcm.delay();
+        if (planar)
+        {
+            chunk.size = stream.plane_stride * chunk.planes;
+            chunk.plane_size = stream.sample_bytes * chunk.meta.frames;
+        }
+        else
+        {
+            chunk.size = stream.out_channels * stream.sample_bytes * chunk.meta.frames;
+        }
+
+        if (shared.active() && audioEnabled())
+        {
+            writeShared(progress, stream);
+            if (!stream.recorder)
+            {
+                chunk.meta.periods = 0;
+                return false;
+            }
+        }
+
+        bool sent = stream.recorder ? stream.recorder->push(chunk, stream.out_rate) : writeAudioToNode(progress, chunk, stream.ring);
+        if (!sent && debug)
+        {
+            fprintf(stderr, "%s full, %u periods dropped\n", stream.recorder ? "record queue" : "audio queue", chunk.meta.periods);
+        }
+
+        if (sent)
+        {
+            stream.buffer = NULL;
+        }
+        chunk.meta.periods = 0;
+        return sent;
+    }
+
+    /* sharedBuffer: copies the batch into the ring; a consumer blocked in Atomics.wait is woken from the JS thread, see drained() */
+    void writeShared(const ExecutionProgress &progress, CaptureStream &stream)
+    {
+        AudioChunk &chunk = stream.chunk;
+        if (!shared.write(stream.buffer, chunk.size))
+        {
+            if (debug)
+            {
+                fprintf(stderr, "shared buffer full, %u periods dropped\n", chunk.meta.periods);
+            }
+            dropFrames(progress, chunk.meta.frames);
+            return;
+        }
+
+        CaptureCounters::add(counters.chunks_delivered);
+        CaptureCounters::add(counters.bytes_delivered, chunk.size);
+        if (shared.consumerWaiting() && !shared_notify.exchange(true))
+        {
+            progress.Signal();
+        }
+    }
+
+    /* channels, device, format, periodSize, periodTime, rate, bufferSize, periods, availMin, startThreshold and access of a capture or of one entry of devices */
+    static bool parse_pcm_options(v8::Local<v8::Object> &options, PcmConfig &config)
+    {
+        {
+            // v8::Local<v8::Value> channels_ = options->Get(New<v8::String>("channels").ToLocalChecked());
+            v8::Local<v8::Value> channels_ = Nan::Get(
+                                                 options,
+                                                 Nan::New("channels").ToLocalChecked())
+                                                 .ToLocalChecked();
+
+            if (!channels_->IsUndefined())
+            {
+                bool channels_okay = true;
+
+                if (channels_->IsNumber())
+                {
+                    config.channels = Nan::To<int>(channels_).FromJust();
+                }
+                else
+                {
+                    channels_okay = false;
+                }
+
+                if (!channels_okay || config.channels < 0)
+                {
+                    Nan::ThrowError("channels has to be a positive number");
+                    return false;
+                }
+            }
+        }
+
+        {
+            // v8::Local<v8::Value> device_ = options->Get(New<v8::String>("device").ToLocalChecked());
+            v8::Local<v8::Value> device_ = Nan::Get(
+                                               options,
+                                               Nan::New("device").ToLocalChecked())
+                                               .ToLocalChecked();
+            if (!device_->IsUndefined())
+            {
+                if (device_->IsString())
+                {
+                    // v8::Isolate *isolate = v8::Isolate::GetCurrent();
+                    // v8::String::Utf8Value deviceUTF8(isolate, device_);
+                    // config.device = std::string(*deviceUTF8);
+                    config.device = *Nan::Utf8String(device_);
+                }
+                else
+                {
+                    Nan::ThrowError("device has to be a string");
+                    return false;
+                }
+            }
+        }
+
+        {
+            std::string format_name_;
+            // v8::Local<v8::Value> format_ = options->Get(New<v8::String>("format").ToLocalChecked());
+            v8::Local<v8::Value> format_ = Nan::Get(
+                                               options,
+                                               Nan::New("format").ToLocalChecked())
+                                               .ToLocalChecked();
+
+            if (!format_->IsUndefined())
+            {
+                if (format_->IsString())
+                {
+                    // v8::Isolate *isolate = v8::Isolate::GetCurrent();
+                    // v8::String::Utf8Value formatUTF8(isolate, format_);
+                    // format_name_ = std::string(*formatUTF8);
+                    format_name_ = *Nan::Utf8String(format_);
+                }
+                else
+                {
+                    Nan::ThrowError("format has to be a string");
+                    return false;
+                }
+
+                bool found = false;
+                std::string all_formats = "";
+                for (int fn = 0; fn < SND_PCM_FORMAT_LAST; fn++)
+                {
+                    auto format_enum = static_cast<_snd_pcm_format>(fn);
+                    const char *format_name = snd_pcm_format_name(format_enum);
+
+                    if (!format_name)
+                    {
+                        continue;
+                    }
+
+                    if (strcmp(format_name, format_name_.c_str()) == 0)
+                    {
+                        found = true;
+                        config.format = format_enum;
+                        break;
+                    }
+
+                    if (!(!snd_pcm_format_linear(config.format) &&
+                          !(config.format == SND_PCM_FORMAT_FLOAT_LE ||
+                            config.format == SND_PCM_FORMAT_FLOAT_BE)))
+                    {
+                        all_formats += std::string(format_name);
+                        all_formats += " ";
+                    }
+                }
+
+                if (!found)
+                {
+                    auto error_msg = std::string("format not supported; supported: ");
+                    error_msg += all_formats;
+                    Nan::ThrowError(error_msg.c_str());
+                    return false;
+                }
+
+                if (!snd_pcm_format_linear(config.format) &&
+                    !(config.format == SND_PCM_FORMAT_FLOAT_LE ||
+                      config.format == SND_PCM_FORMAT_FLOAT_BE))
+                {
+                    Nan::ThrowError("Invalid (non-linear/float) format");
+                    return false;
+                }
+            }
+        }
+
+        {
+            // v8::Local<v8::Value> period_size_ = options->Get(New<v8::String>("periodSize").ToLocalChecked());
+            v8::Local<v8::Value> period_size_ = Nan::Get(
+                                                    options,
+                                                    Nan::New("periodSize").ToLocalChecked())
+                                                    .ToLocalChecked();
+
+            if (!period_size_->IsUndefined())
+            {
+                bool period_size_okay = true;
+
+                if (period_size_->IsNumber())
+                {
+                    config.period_size = Nan::To<int>(period_size_).FromJust();
+                }
+                else
+                {
+                    period_size_okay = false;
+                }
+
+                if (!period_size_okay || config.period_size < 0)
+                {
+                    Nan::ThrowError("period_size has to be a positive number");
+                    return false;
+                }
+            }
+        }
+
+        {
+            // v8::Local<v8::Value> period_time_ = options->Get(New<v8::String>("periodTime").ToLocalChecked());
+            v8::Local<v8::Value> period_time_ = Nan::Get(
+                                                    options,
+                                                    Nan::New("periodTime").ToLocalChecked())
+                                                    .ToLocalChecked();
+
+            if (!period_time_->IsUndefined())
+            {
+                bool period_time_okay = true;
+
+                if (period_time_->IsNumber())
+                {
+                    config.period_time = Nan::To<int>(period_time_).FromJust();
+                }
+                else
+                {
+                    period_time_okay = false;
+                }
+
+                if (!period_time_okay || config.period_time < 0)
+                {
+                    Nan::ThrowError("period_time has to be a positive number");
+                    return false;
+                }
+            }
+        }
+
+        {
+            // v8::Local<v8::Value> rate_ = options->Get(New<v8::String>("rate").ToLocalChecked());
+            v8::Local<v8::Value> rate_ = Nan::Get(
+                                             options,
+                                             Nan::New("rate").ToLocalChecked())
+                                             .ToLocalChecked();
+
+            if (!rate_->IsUndefined())
+            {
+                bool rate_okay = true;
+
+                if (rate_->IsNumber())
+                {
+                    config.rate = Nan::To<int>(rate_).FromJust();
+                }
+                else
+                {
+                    rate_okay = false;
+                }
+
+                if (!rate_okay || (config.rate < 4000 || config.rate > 384000))
+                {
+                    Nan::ThrowError("rate has to be a value between 4000 and 384000");
+                    return false;
+                }
+            }
+        }
+
+        if (!get_int_option(options, "bufferSize", config.buffer_size, 0, INT_MAX,
+                            "bufferSize has to be a positive number") ||
+            !get_int_option(options, "periods", config.periods, 1, 1024,
+                            "periods has to be a value between 1 and 1024") ||
+            !get_int_option(options, "availMin", config.avail_min, 0, INT_MAX,
+                            "availMin has to be a positive number") ||
+            !get_int_option(options, "startThreshold", config.start_threshold, 0, INT_MAX,
+                            "startThreshold has to be a positive number"))
+        {
+            return false;
+        }
+
+        std::string access;
+        if (!get_string_option(options, "access", access, "access has to be a string"))
+        {
+            return false;
+        }
+        if (!access.empty())
+        {
+            if (access != "rw" && access != "mmap")
+            {
+                Nan::ThrowError("access has to be rw or mmap");
+                return false;
+            }
+            config.mmap = access == "mmap";
+        }
+
+        return true;
+    }
+
+    /* channelMap and mix, checked against the channels of every device */
+    bool parse_channel_options(v8::Local<v8::Object> &options)
+    {
+        v8::Local<v8::Value> map_ = Nan::Get(
+                                        options,
+                                        Nan::New("channelMap").ToLocalChecked())
+                                        .ToLocalChecked();
+        v8::Local<v8::Value> mix_ = Nan::Get(
+                                        options,
+                                        Nan::New("mix").ToLocalChecked())
+                                        .ToLocalChecked();
+
+        if (!map_->IsUndefined() && !mix_->IsUndefined())
+        {
+            Nan::ThrowError("channelMap and mix cannot be combined");
+            return false;
+        }
+
+        if (!map_->IsUndefined())
+        {
+            if (!map_->IsArray() || map_.As<v8::Array>()->Length() == 0)
+            {
+                Nan::ThrowError("channelMap has to be a non-empty array of channel numbers");
+                return false;
+            }
+
+            v8::Local<v8::Array> map = map_.As<v8::Array>();
+            for (uint32_t o = 0; o < map->Length(); o++)
+            {
+                v8::Local<v8::Value> channel = Nan::Get(map, o).ToLocalChecked();
+                if (!channel->IsNumber() || Nan::To<int>(channel).FromJust() < 0 ||
+                    !channels_available(Nan::To<int>(channel).FromJust() + 1))
+                {
+                    Nan::ThrowError("channelMap entries have to be channel numbers below channels");
+                    return false;
                 }
+                channel_map.push_back(Nan::To<int>(channel).FromJust());
+            }
+        }
 
-                Message shortRead("shortRead", std::to_string(rc), "");
-                writeToNode(progress, shortRead);
+        if (!mix_->IsUndefined())
+        {
+            if (output_format == SAMPLE_OUTPUT_RAW)
+            {
+                Nan::ThrowError("mix needs outputFormat f32 or s16");
+                return false;
+            }
+            if (!mix_->IsArray() || mix_.As<v8::Array>()->Length() == 0)
+            {
+                Nan::ThrowError("mix has to be a non-empty array of gain arrays");
+                return false;
             }
 
-            string bufferStringRaw(buffer, size);
-            Message tosend("audio", "", bufferStringRaw);
-            writeToNode(progress, tosend);
+            v8::Local<v8::Array> rows = mix_.As<v8::Array>();
+            for (uint32_t o = 0; o < rows->Length(); o++)
+            {
+                v8::Local<v8::Value> row_ = Nan::Get(rows, o).ToLocalChecked();
+                if (!row_->IsArray() || !channels_available(row_.As<v8::Array>()->Length()))
+                {
+                    Nan::ThrowError("mix has to hold one array of gains per output channel, with at most channels gains");
+                    return false;
+                }
+
+                v8::Local<v8::Array> row = row_.As<v8::Array>();
+                std::vector<float> gains;
+                for (uint32_t i = 0; i < row->Length(); i++)
+                {
+                    v8::Local<v8::Value> gain = Nan::Get(row, i).ToLocalChecked();
+                    if (!gain->IsNumber())
+                    {
+                        Nan::ThrowError("mix gains have to be numbers");
+                        return false;
+                    }
+                    gains.push_back(static_cast<float>(Nan::To<double>(gain).FromJust()));
+                }
+                mix_matrix.push_back(gains);
+            }
         }
 
-        snd_pcm_drain(handle);
-        snd_pcm_close(handle);
+        return true;
     }
 
-private:
-    int channels;
-    std::string device;
-    _snd_pcm_format format;
-    int period_size;
-    int period_time;
-    int rate;
+    /* whether every device captures at least count channels */
+    bool channels_available(uint32_t count)
+    {
+        for (const PcmConfig &config : configs)
+        {
+            if (static_cast<uint32_t>(config.channels) < count)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /* devices: an array of device names or of objects overriding the pcm options per device */
+    bool parse_devices_option(v8::Local<v8::Object> &options)
+    {
+        v8::Local<v8::Value> devices_ = Nan::Get(
+                                            options,
+                                            Nan::New("devices").ToLocalChecked())
+                                            .ToLocalChecked();
+
+        if (devices_->IsUndefined())
+        {
+            return true;
+        }
+
+        if (!devices_->IsArray() || devices_.As<v8::Array>()->Length() == 0)
+        {
+            Nan::ThrowError("devices has to be a non-empty array");
+            return false;
+        }
+
+        v8::Local<v8::Array> devices = devices_.As<v8::Array>();
+        for (uint32_t i = 0; i < devices->Length(); i++)
+        {
+            v8::Local<v8::Value> entry = Nan::Get(devices, i).ToLocalChecked();
+            PcmConfig config = base_config;
+
+            if (entry->IsString())
+            {
+                config.device = *Nan::Utf8String(entry);
+            }
+            else if (entry->IsObject())
+            {
+                v8::Local<v8::Object> entry_options = entry.As<v8::Object>();
+                if (!parse_pcm_options(entry_options, config))
+                {
+                    return false;
+                }
+            }
+            else
+            {
+                Nan::ThrowError("devices entries have to be device names or option objects");
+                return false;
+            }
+
+            configs.push_back(config);
+        }
+
+        has_devices = true;
+        return true;
+    }
+
+    /* the granted buffering of a device and, measured on its first period, how long audio actually takes to arrive */
+    void reportLatency(const ExecutionProgress &progress, CaptureStream &stream)
+    {
+        PcmDevice &pcm = stream.pcm;
+        double frame_ms = 1000.0 / pcm.actual_rate;
+        double first_period = (monotonic_ns() - stream.started_at) / 1e6;
+        double delay = pcm.delay() * frame_ms;
+
+        Message latency("latency", "", "");
+        latency.device = stream.id;
+        latency.set("periodSize", pcm.frames)
+            .set("periods", pcm.periods)
+            .set("bufferSize", pcm.buffer_size)
+            .set("availMin", pcm.avail_min)
+            .set("startThreshold", pcm.start_threshold)
+            .set("periodTime", pcm.frames * frame_ms)
+            .set("bufferTime", pcm.buffer_size * frame_ms)
+            .set("firstPeriod", first_period)
+            .set("delay", delay)
+            .set("measured", pcm.frames * frame_ms + delay);
+
+        if (debug)
+        {
+            fprintf(stderr, "First period after %.3f ms, delay %.3f ms\n", first_period, delay);
+        }
+
+        writeToNode(progress, latency);
+        stream.latency_reported = true;
+    }
+
+    /* tells JS which of the requested scheduling settings the system granted */
+    void reportThreadConfig(const ExecutionProgress &progress, const ThreadConfigResult &result)
+    {
+        Message scheduling("threadScheduling", "", "");
+
+        if (thread_config.policy >= 0)
+        {
+            scheduling.setString("policy", thread_policy_name(thread_config.policy))
+                .set("priority", thread_config.priority)
+                .setBool("policyGranted", result.policy_granted);
+        }
+        if (thread_config.set_nice)
+        {
+            scheduling.set("nice", thread_config.nice).setBool("niceGranted", result.nice_granted);
+        }
+        if (!thread_config.cpus.empty())
+        {
+            scheduling.setBool("affinityGranted", result.affinity_granted);
+        }
+        if (thread_config.lock_memory)
+        {
+            scheduling.setBool("mlockGranted", result.mlock_granted);
+        }
+
+        if (debug)
+        {
+            fprintf(stderr, "Scheduling policy: %s %s\n", thread_policy_name(thread_config.policy), result.policy_error.c_str());
+            fprintf(stderr, "Nice: %d %s\n", thread_config.nice, result.nice_error.c_str());
+            fprintf(stderr, "Affinity: %s\n", result.affinity_error.c_str());
+            fprintf(stderr, "mlock: %s\n", result.mlock_error.c_str());
+        }
+
+        writeToNode(progress, scheduling);
+    }
+
+    /* record: { path, container, segmentSeconds, fsyncInterval, direct } */
+    bool parse_record_option(v8::Local<v8::Object> &options)
+    {
+        v8::Local<v8::Value> record_ = Nan::Get(
+                                           options,
+                                           Nan::New("record").ToLocalChecked())
+                                           .ToLocalChecked();
+
+        if (record_->IsUndefined())
+        {
+            return true;
+        }
+        if (!record_->IsObject())
+        {
+            Nan::ThrowError("record has to be an object");
+            return false;
+        }
+
+        v8::Local<v8::Object> record = record_.As<v8::Object>();
+        std::string container;
+        if (!get_string_option(record, "path", record_config.path, "record.path has to be a string") ||
+            !get_string_option(record, "container", container, "record.container has to be a string") ||
+            !get_int_option(record, "segmentSeconds", record_config.segment_seconds, 0, 86400,
+                            "record.segmentSeconds has to be a value between 0 and 86400") ||
+            !get_int_option(record, "fsyncInterval", record_config.fsync_interval, 0, 3600,
+                            "record.fsyncInterval has to be a value between 0 and 3600") ||
+            !get_bool_option(record, "direct", record_config.direct, "record.direct has to be a bool"))
+        {
+            return false;
+        }
+        if (record_config.path.empty())
+        {
+            Nan::ThrowError("record.path is required");
+            return false;
+        }
+        if (!container.empty() && container != "wav" && container != "raw")
+        {
+            Nan::ThrowError("record.container has to be wav or raw");
+            return false;
+        }
+        record_config.wav = container != "raw";
+        recording = true;
+        return true;
+    }
+
+    /* sharedBuffer: a SharedArrayBuffer the frames are written to instead of "audio" events */
+    bool parse_shared_option(v8::Local<v8::Object> &options)
+    {
+        v8::Local<v8::Value> shared_ = Nan::Get(
+                                           options,
+                                           Nan::New("sharedBuffer").ToLocalChecked())
+                                           .ToLocalChecked();
+
+        if (shared_->IsUndefined())
+        {
+            return true;
+        }
+        if (!shared_->IsSharedArrayBuffer())
+        {
+            Nan::ThrowError("sharedBuffer has to be a SharedArrayBuffer");
+            return false;
+        }
+
+        v8::Local<v8::SharedArrayBuffer> buffer = shared_.As<v8::SharedArrayBuffer>();
+        if (buffer->ByteLength() <= SharedRing::header_bytes)
+        {
+            Nan::ThrowError("sharedBuffer has to be larger than 64 bytes");
+            return false;
+        }
+
+        /* Atomics of this context, to wake the consumer with */
+        v8::Local<v8::Value> atomics_ = Nan::Get(
+                                            Nan::GetCurrentContext()->Global(),
+                                            Nan::New("Atomics").ToLocalChecked())
+                                            .ToLocalChecked();
+        if (!atomics_->IsObject())
+        {
+            Nan::ThrowError("sharedBuffer needs Atomics");
+            return false;
+        }
+        v8::Local<v8::Value> notify_ = Nan::Get(
+                                           atomics_.As<v8::Object>(),
+                                           Nan::New("notify").ToLocalChecked())
+                                           .ToLocalChecked();
+        if (!notify_->IsFunction())
+        {
+            Nan::ThrowError("sharedBuffer needs Atomics.notify");
+            return false;
+        }
+
+        // the backing store keeps the memory alive even if JS drops the buffer before the capture ends
+        shared_store = buffer->GetBackingStore();
+        shared = SharedRing(static_cast<char *>(shared_store->Data()), shared_store->ByteLength());
+        shared_header.Reset(v8::Int32Array::New(buffer, 0, SharedRing::header_bytes / sizeof(int32_t)));
+        atomics.Reset(atomics_.As<v8::Object>());
+        atomics_notify.Reset(notify_.As<v8::Function>());
+        return true;
+    }
+
+    /* gate: true or { threshold, hangover, preRoll, block } */
+    bool parse_gate_option(v8::Local<v8::Object> &options)
+    {
+        v8::Local<v8::Value> gate_ = Nan::Get(
+                                         options,
+                                         Nan::New("gate").ToLocalChecked())
+                                         .ToLocalChecked();
+
+        if (gate_->IsUndefined() || (gate_->IsBoolean() && !Nan::To<bool>(gate_).FromJust()))
+        {
+            return true;
+        }
+        gate_enabled = true;
+        if (gate_->IsBoolean())
+        {
+            return true;
+        }
+        if (!gate_->IsObject())
+        {
+            Nan::ThrowError("gate has to be a bool or an object");
+            return false;
+        }
+
+        v8::Local<v8::Object> gate = gate_.As<v8::Object>();
+        return get_int_option(gate, "threshold", gate_threshold, -150, 0,
+                              "gate.threshold has to be a value between -150 and 0") &&
+               get_int_option(gate, "hangover", gate_hangover, 0, 60000,
+                              "gate.hangover has to be a value between 0 and 60000") &&
+               get_int_option(gate, "preRoll", gate_pre_roll, 0, 10000,
+                              "gate.preRoll has to be a value between 0 and 10000") &&
+               get_int_option(gate, "block", gate_block, 1, 1000,
+                              "gate.block has to be a value between 1 and 1000");
+    }
+
+    /* schedPolicy, schedPriority, nice, cpuAffinity and mlock */
+    bool parse_thread_options(v8::Local<v8::Object> &options)
+    {
+        std::string policy_name;
+        if (!get_string_option(options, "schedPolicy", policy_name, "schedPolicy has to be a string"))
+        {
+            return false;
+        }
+        if (!policy_name.empty())
+        {
+            thread_config.policy = thread_policy_from_name(policy_name);
+            if (thread_config.policy < 0)
+            {
+                Nan::ThrowError("schedPolicy has to be one of fifo, rr, other");
+                return false;
+            }
+        }
+
+        int priority = -1;
+        if (!get_int_option(options, "schedPriority", priority, 1, 99,
+                            "schedPriority has to be a value between 1 and 99"))
+        {
+            return false;
+        }
+        if (priority > 0)
+        {
+            if (thread_config.policy < 0)
+            {
+                thread_config.policy = SCHED_FIFO;
+            }
+            thread_config.priority = priority;
+        }
+        else if (thread_config.policy == SCHED_FIFO || thread_config.policy == SCHED_RR)
+        {
+            thread_config.priority = sched_get_priority_min(thread_config.policy);
+        }
+
+        int nice = INT_MIN;
+        if (!get_int_option(options, "nice", nice, -20, 19, "nice has to be a value between -20 and 19"))
+        {
+            return false;
+        }
+        if (nice != INT_MIN)
+        {
+            thread_config.set_nice = true;
+            thread_config.nice = nice;
+        }
+
+        v8::Local<v8::Value> affinity_ = Nan::Get(
+                                             options,
+                                             Nan::New("cpuAffinity").ToLocalChecked())
+                                             .ToLocalChecked();
+        if (affinity_->IsArray())
+        {
+            v8::Local<v8::Array> cpus = affinity_.As<v8::Array>();
+            for (uint32_t i = 0; i < cpus->Length(); i++)
+            {
+                v8::Local<v8::Value> cpu = Nan::Get(cpus, i).ToLocalChecked();
+                if (!cpu->IsNumber() || Nan::To<int>(cpu).FromJust() < 0 || Nan::To<int>(cpu).FromJust() >= CPU_SETSIZE)
+                {
+                    Nan::ThrowError("cpuAffinity has to be a bit mask or an array of cpu numbers");
+                    return false;
+                }
+                thread_config.cpus.push_back(Nan::To<int>(cpu).FromJust());
+            }
+        }
+        else if (affinity_->IsNumber())
+        {
+            double mask = Nan::To<double>(affinity_).FromJust();
+            for (int cpu = 0; cpu < 53 && mask >= 1; cpu++, mask = std::floor(mask / 2))
+            {
+                if (std::fmod(mask, 2) >= 1)
+                {
+                    thread_config.cpus.push_back(cpu);
+                }
+            }
+        }
+        else if (!affinity_->IsUndefined())
+        {
+            Nan::ThrowError("cpuAffinity has to be a bit mask or an array of cpu numbers");
+            return false;
+        }
+
+        return get_bool_option(options, "mlock", thread_config.lock_memory, "mlock has to be a bool");
+    }
+
+    /* reads an optional boolean option; throws and returns false if it is not a bool */
+    static bool get_bool_option(v8::Local<v8::Object> &options, const char *name, bool &value, const char *error)
+    {
+        v8::Local<v8::Value> value_ = Nan::Get(
+                                          options,
+                                          Nan::New(name).ToLocalChecked())
+                                          .ToLocalChecked();
+
+        if (value_->IsUndefined())
+        {
+            return true;
+        }
+
+        if (!value_->IsBoolean())
+        {
+            Nan::ThrowError(error);
+            return false;
+        }
+
+        value = Nan::To<bool>(value_).FromJust();
+        return true;
+    }
+
+    /* reads an optional string option; throws and returns false if it is not a string */
+    static bool get_string_option(v8::Local<v8::Object> &options, const char *name, std::string &value, const char *error)
+    {
+        v8::Local<v8::Value> value_ = Nan::Get(
+                                          options,
+                                          Nan::New(name).ToLocalChecked())
+                                          .ToLocalChecked();
+
+        if (value_->IsUndefined())
+        {
+            return true;
+        }
+
+        if (!value_->IsString())
+        {
+            Nan::ThrowError(error);
+            return false;
+        }
+
+        value = *Nan::Utf8String(value_);
+        return true;
+    }
+
+    /* reads an optional integer option; throws and returns false if it is not a number in [min, max] */
+    static bool get_int_option(v8::Local<v8::Object> &options, const char *name, int &value, int min, int max, const char *error)
+    {
+        v8::Local<v8::Value> value_ = Nan::Get(
+                                          options,
+                                          Nan::New(name).ToLocalChecked())
+                                          .ToLocalChecked();
+
+        if (value_->IsUndefined())
+        {
+            return true;
+        }
+
+        if (!value_->IsNumber())
+        {
+            Nan::ThrowError(error);
+            return false;
+        }
+
+        double number = Nan::To<double>(value_).FromJust();
+        if (number < min || number > max)
+        {
+            Nan::ThrowError(error);
+            return false;
+        }
+
+        value = static_cast<int>(number);
+        return true;
+    }
+
+    PcmConfig base_config;
+    std::vector<PcmConfig> configs;
+    bool has_devices;
+    // historySeconds of each entry of configs, read by getHistory() on the JS thread
+    struct DeviceHistory
+    {
+        DeviceHistory() : sample_type(SAMPLE_OUTPUT_RAW) {}
+        std::unique_ptr<HistoryRing> ring;
+        int sample_type;
+    };
+    std::mutex histories_mu;
+    // levelsInterval in ms, 0 without levels
+    int levels_interval;
+    // record
+    bool recording;
+    RecordConfig record_config;
+    // shared device, as subscriber: the stream the owner's thread feeds, the progress of this capture's thread, and why the feed ended
+    CaptureStream *subscriber_stream;
+    const ExecutionProgress *subscriber_progress;
+    std::atomic<bool> source_lost;
+    std::string source_lost_reason;
+    // shared device, as subscriber: the reader ended and handed the device to this capture
+    std::atomic<bool> take_over;
+    // sharedBuffer: the ring, its memory, and what drained() needs to wake the consumer
+    SharedRing shared;
+    std::shared_ptr<v8::BackingStore> shared_store;
+    std::atomic<bool> shared_notify;
+    Nan::Persistent<v8::Int32Array> shared_header;
+    Nan::Persistent<v8::Object> atomics;
+    Nan::Persistent<v8::Function> atomics_notify;
+    // resample/outputRate; output_rate 0 resamples to the rate asked for
+    bool resampling;
+    ResampleQuality resample_quality;
+    int output_rate;
+    // gate: threshold in dBFS, the rest in ms
+    bool gate_enabled;
+    int gate_threshold;
+    int gate_hangover;
+    int gate_pre_roll;
+    int gate_block;
+    std::vector<DeviceHistory> histories;
+    int history_seconds;
+    // eventfd per engine thread, see wake()
+    std::vector<int> wake_fds;
+    bool adaptive;
+    bool reopen;
+    int min_latency;
+    int max_latency;
+    int pool_size;
+    int delivery_interval;
+    int min_batch_frames;
+    int threads;
+    ThreadConfig thread_config;
+    SampleOutput output_format;
+    std::vector<int> channel_map;
+    std::vector<std::vector<float>> mix_matrix;
+    bool planar;
     bool error_init;
     bool debug;
 };
@@ -461,6 +3071,128 @@ StreamingWorker *create_worker(Callback *data, Callback *complete, Callback *err
     return new Capture(data, complete, error_callback, options);
 }
 
+/* listDevices() and probe() on the libuv threadpool; callback(error, result) */
+class ProbeWorker : public Nan::AsyncWorker
+{
+public:
+    ProbeWorker(Callback *callback, const std::string &device, bool list, bool refresh)
+        : Nan::AsyncWorker(callback, "alsa-capture:probe"), device(device), list(list), refresh(refresh) {}
+
+    void Execute()
+    {
+        std::string error;
+        bool ok = list ? device_probe::cache().devices(devices, error, refresh)
+                       : device_probe::cache().probe(device, caps, error, refresh);
+        if (!ok)
+        {
+            SetErrorMessage(error.c_str());
+        }
+    }
+
+    void HandleOKCallback()
+    {
+        Nan::HandleScope scope;
+        v8::Local<v8::Value> result = list ? devicesToJs() : capsToJs();
+
+        v8::Local<v8::Value> argv[] = {Nan::Null(), result};
+        callback->Call(2, argv, async_resource);
+    }
+
+private:
+    v8::Local<v8::Value> devicesToJs()
+    {
+        v8::Local<v8::Array> array = New<v8::Array>(static_cast<int>(devices.size()));
+        for (size_t i = 0; i < devices.size(); i++)
+        {
+            v8::Local<v8::Object> device = New<v8::Object>();
+            Nan::Set(device, New("name").ToLocalChecked(), New(devices[i].name).ToLocalChecked());
+            Nan::Set(device, New("description").ToLocalChecked(), New(devices[i].description).ToLocalChecked());
+            Nan::Set(array, static_cast<uint32_t>(i), device);
+        }
+        return array;
+    }
+
+    static v8::Local<v8::Object> range(double min, double max)
+    {
+        v8::Local<v8::Object> object = New<v8::Object>();
+        Nan::Set(object, New("min").ToLocalChecked(), New<v8::Number>(min));
+        Nan::Set(object, New("max").ToLocalChecked(), New<v8::Number>(max));
+        return object;
+    }
+
+    v8::Local<v8::Value> capsToJs()
+    {
+        v8::Local<v8::Object> result = New<v8::Object>();
+        v8::Local<v8::Array> rates = New<v8::Array>(static_cast<int>(caps.rates.size()));
+        v8::Local<v8::Array> formats = New<v8::Array>(static_cast<int>(caps.formats.size()));
+
+        for (size_t i = 0; i < caps.rates.size(); i++)
+        {
+            Nan::Set(rates, static_cast<uint32_t>(i), New<v8::Number>(caps.rates[i]));
+        }
+        for (size_t i = 0; i < caps.formats.size(); i++)
+        {
+            Nan::Set(formats, static_cast<uint32_t>(i), New(caps.formats[i]).ToLocalChecked());
+        }
+
+        Nan::Set(result, New("device").ToLocalChecked(), New(device).ToLocalChecked());
+        Nan::Set(result, New("card").ToLocalChecked(), New<v8::Number>(caps.card));
+        Nan::Set(result, New("channels").ToLocalChecked(), range(caps.channels_min, caps.channels_max));
+        Nan::Set(result, New("rate").ToLocalChecked(), range(caps.rate_min, caps.rate_max));
+        Nan::Set(result, New("rates").ToLocalChecked(), rates);
+        Nan::Set(result, New("formats").ToLocalChecked(), formats);
+        Nan::Set(result, New("periodSize").ToLocalChecked(), range(caps.period_size_min, caps.period_size_max));
+        Nan::Set(result, New("bufferSize").ToLocalChecked(), range(caps.buffer_size_min, caps.buffer_size_max));
+        Nan::Set(result, New("mmap").ToLocalChecked(), New<v8::Boolean>(caps.mmap));
+        return result;
+    }
+
+    std::string device;
+    bool list;
+    bool refresh;
+    std::vector<device_probe::DeviceInfo> devices;
+    device_probe::DeviceCaps caps;
+};
+
+/* listDevices(refresh, callback) */
+NAN_METHOD(ListDevices)
+{
+    if (!info[1]->IsFunction())
+    {
+        Nan::ThrowError("No callback");
+        return;
+    }
+
+    Callback *callback = new Callback(info[1].As<v8::Function>());
+    Nan::AsyncQueueWorker(new ProbeWorker(callback, "", true, info[0]->IsTrue()));
+}
+
+/* probe(device, refresh, callback) */
+NAN_METHOD(ProbeDevice)
+{
+    if (!info[0]->IsString())
+    {
+        Nan::ThrowError("device has to be a string");
+        return;
+    }
+    if (!info[2]->IsFunction())
+    {
+        Nan::ThrowError("No callback");
+        return;
+    }
+
+    Callback *callback = new Callback(info[2].As<v8::Function>());
+    Nan::AsyncQueueWorker(new ProbeWorker(callback, *Nan::Utf8String(info[0]), false, info[1]->IsTrue()));
+}
+
+NAN_MODULE_INIT(Init)
+{
+    StreamWorkerWrapper::Init(target);
+    Nan::SetMethod(target, "listDevices", ListDevices);
+    Nan::SetMethod(target, "probe", ProbeDevice);
+}
+
+/* context aware, so the addon also loads in worker threads */
 DISABLE_WCAST_FUNCTION_TYPE
-NODE_MODULE(capture, StreamWorkerWrapper::Init)
+NAN_MODULE_WORKER_ENABLED(capture, Init)
 DISABLE_WCAST_FUNCTION_TYPE_END
@@ -0,0 +1,239 @@
+#ifndef ____ChannelMix__
+#define ____ChannelMix__
+
+#include <stdint.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#include "deinterleave.h"
+#include "sample-convert.h"
+
+/*
+ * Channel selection (channelMap) and mixing (mix) of interleaved frames on the
+ * capture thread, so only the channels JS actually wants cross into V8.
+ *
+ * A map copies samples of any format: output channel o is input channel
+ * map[o]. A mix works on Float32 input: output channel o is the sum of
+ * gains[o][i] * input channel i, written as Float32 or S16.
+ */
+class ChannelMixer
+{
+public:
+    ChannelMixer()
+        : mode(NONE), in_channels(0), out_channels(0), sample_bytes(0), output(SAMPLE_OUTPUT_RAW) {}
+
+    static ChannelMixer selection(const std::vector<int> &map, size_t in_channels, size_t sample_bytes)
+    {
+        ChannelMixer mixer;
+        mixer.mode = MAP;
+        mixer.in_channels = in_channels;
+        mixer.out_channels = map.size();
+        mixer.sample_bytes = sample_bytes;
+        mixer.map = map;
+        return mixer;
+    }
+
+    static ChannelMixer matrix(const std::vector<std::vector<float>> &gains, size_t in_channels, SampleOutput output)
+    {
+        ChannelMixer mixer;
+        mixer.mode = MIX;
+        mixer.in_channels = in_channels;
+        mixer.out_channels = gains.size();
+        mixer.sample_bytes = output == SAMPLE_OUTPUT_S16 ? sizeof(int16_t) : sizeof(float);
+        mixer.output = output;
+
+        // flattened, zero gains skipped when mixing
+        for (size_t o = 0; o < gains.size(); o++)
+        {
+            for (size_t i = 0; i < in_channels; i++)
+            {
+                float gain = i < gains[o].size() ? gains[o][i] : 0.0f;
+                mixer.gains.push_back(gain);
+            }
+        }
+
+        mixer.planes.resize(in_channels * block_frames);
+        mixer.sum.resize(block_frames);
+        return mixer;
+    }
+
+    bool active() const
+    {
+        return mode != NONE;
+    }
+
+    size_t outputChannels() const
+    {
+        return out_channels;
+    }
+
+    /* bytes per output sample */
+    size_t outputBytes() const
+    {
+        return sample_bytes;
+    }
+
+    /* in holds frames * in_channels samples, out receives frames * outputChannels() */
+    void process(const char *in, char *out, size_t frames)
+    {
+        if (mode == MAP)
+        {
+            select(in, out, frames);
+        }
+        else if (mode == MIX)
+        {
+            for (size_t start = 0; start < frames; start += block_frames)
+            {
+                size_t n = frames - start < block_frames ? frames - start : block_frames;
+                mixBlock(reinterpret_cast<const float *>(in) + start * in_channels, out + start * out_channels * sample_bytes, n);
+            }
+        }
+    }
+
+private:
+    enum Mode
+    {
+        NONE,
+        MAP,
+        MIX
+    };
+
+    /* frames mixed per pass; the deinterleaved block stays in L1 */
+    static const size_t block_frames = 256;
+
+    template <typename T>
+    void selectSamples(const char *src, char *dst, size_t frames) const
+    {
+        const T *in = reinterpret_cast<const T *>(src);
+        T *out = reinterpret_cast<T *>(dst);
+
+        for (size_t f = 0; f < frames; f++, in += in_channels, out += out_channels)
+        {
+            for (size_t o = 0; o < out_channels; o++)
+            {
+                out[o] = in[map[o]];
+            }
+        }
+    }
+
+    void select(const char *in, char *out, size_t frames) const
+    {
+        switch (sample_bytes)
+        {
+        case 1:
+            return selectSamples<uint8_t>(in, out, frames);
+        case 2:
+            return selectSamples<uint16_t>(in, out, frames);
+        case 4:
+            return selectSamples<uint32_t>(in, out, frames);
+        case 8:
+            return selectSamples<uint64_t>(in, out, frames);
+        default:
+            for (size_t f = 0; f < frames; f++)
+            {
+                for (size_t o = 0; o < out_channels; o++)
+                {
+                    memcpy(out + (f * out_channels + o) * sample_bytes, in + (f * in_channels + map[o]) * sample_bytes, sample_bytes);
+                }
+            }
+        }
+    }
+
+    /* deinterleaves the block, then sums the scaled input planes per output channel */
+    void mixBlock(const float *in, char *out, size_t n)
+    {
+        float *plane_data = planes.data();
+        float *acc = sum.data();
+        deinterleave_frames(reinterpret_cast<const char *>(in), reinterpret_cast<char *>(plane_data),
+                            n, in_channels, sizeof(float), block_frames * sizeof(float));
+
+        for (size_t o = 0; o < out_channels; o++)
+        {
+            const float *row = &gains[o * in_channels];
+            std::fill(acc, acc + n, 0.0f);
+            for (size_t i = 0; i < in_channels; i++)
+            {
+                if (row[i] != 0.0f)
+                {
+                    accumulate(acc, plane_data + i * block_frames, row[i], n);
+                }
+            }
+
+            if (output == SAMPLE_OUTPUT_S16)
+            {
+                int16_t *dst = reinterpret_cast<int16_t *>(out) + o;
+                for (size_t f = 0; f < n; f++, dst += out_channels)
+                {
+                    *dst = sample_convert::float_to_s16(acc[f]);
+                }
+            }
+            else
+            {
+                float *dst = reinterpret_cast<float *>(out) + o;
+                for (size_t f = 0; f < n; f++, dst += out_channels)
+                {
+                    *dst = acc[f];
+                }
+            }
+        }
+    }
+
+    /* acc += gain * plane */
+    static void accumulate(float *acc, const float *plane, float gain, size_t n)
+    {
+#if defined(SAMPLE_CONVERT_X86)
+        static const bool sse2 = sample_convert::has_sse2();
+        if (sse2)
+        {
+            return accumulate_sse2(acc, plane, gain, n);
+        }
+#elif defined(SAMPLE_CONVERT_NEON)
+        size_t f = 0;
+        for (; f + 4 <= n; f += 4)
+        {
+            vst1q_f32(acc + f, vmlaq_n_f32(vld1q_f32(acc + f), vld1q_f32(plane + f), gain));
+        }
+        for (; f < n; f++)
+        {
+            acc[f] += gain * plane[f];
+        }
+        return;
+#endif
+        for (size_t f = 0; f < n; f++)
+        {
+            acc[f] += gain * plane[f];
+        }
+    }
+
+#ifdef SAMPLE_CONVERT_X86
+    __attribute__((target("sse2"))) static void accumulate_sse2(float *acc, const float *plane, float gain, size_t n)
+    {
+        const __m128 g = _mm_set1_ps(gain);
+        size_t f = 0;
+
+        for (; f + 4 <= n; f += 4)
+        {
+            _mm_storeu_ps(acc + f, _mm_add_ps(_mm_loadu_ps(acc + f), _mm_mul_ps(_mm_loadu_ps(plane + f), g)));
+        }
+        for (; f < n; f++)
+        {
+            acc[f] += gain * plane[f];
+        }
+    }
+#endif
+
+    Mode mode;
+    size_t in_channels;
+    size_t out_channels;
+    size_t sample_bytes;
+    SampleOutput output;
+    std::vector<int> map;
+    std::vector<float> gains;
+    // per block scratch of a mix: input planes and the output accumulator
+    std::vector<float> planes;
+    std::vector<float> sum;
+};
+
+#endif // ____ChannelMix__
@@ -0,0 +1,159 @@
+#ifndef ____Deinterleave__
+#define ____Deinterleave__
+
+#include <stdint.h>
+#include <cstddef>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DEINTERLEAVE_X86 1
+#include <immintrin.h>
+#endif
+
+/*
+ * Transposes interleaved frames into one plane per channel for the planar
+ * layout. Plane c starts at dst + c * plane_stride; frame i of a channel is
+ * written to sample offset i of its plane.
+ */
+namespace deinterleave
+{
+    /* frames handled per pass over the channels, keeps source and planes in cache for wide frames */
+    const size_t block_frames = 64;
+
+    template <typename T>
+    inline void blocked(const char *src, char *dst, size_t frames, size_t channels, size_t plane_stride)
+    {
+        const T *in = reinterpret_cast<const T *>(src);
+
+        for (size_t start = 0; start < frames; start += block_frames)
+        {
+            size_t end = start + block_frames < frames ? start + block_frames : frames;
+            for (size_t c = 0; c < channels; c++)
+            {
+                T *plane = reinterpret_cast<T *>(dst + c * plane_stride);
+                const T *sample = in + start * channels + c;
+                for (size_t i = start; i < end; i++, sample += channels)
+                {
+                    plane[i] = *sample;
+                }
+            }
+        }
+    }
+
+    /* odd sample sizes (3 byte formats) */
+    inline void blocked_bytes(const char *src, char *dst, size_t frames, size_t channels, size_t plane_stride, size_t sample_bytes)
+    {
+        size_t frame_bytes = channels * sample_bytes;
+
+        for (size_t start = 0; start < frames; start += block_frames)
+        {
+            size_t end = start + block_frames < frames ? start + block_frames : frames;
+            for (size_t c = 0; c < channels; c++)
+            {
+                char *plane = dst + c * plane_stride;
+                for (size_t i = start; i < end; i++)
+                {
+                    memcpy(plane + i * sample_bytes, src + i * frame_bytes + c * sample_bytes, sample_bytes);
+                }
+            }
+        }
+    }
+
+#ifdef DEINTERLEAVE_X86
+    /* stereo fast paths, the most common case */
+    __attribute__((target("sse2"))) inline void stereo32(const char *src, char *dst, size_t frames, size_t plane_stride)
+    {
+        const float *in = reinterpret_cast<const float *>(src);
+        float *left = reinterpret_cast<float *>(dst);
+        float *right = reinterpret_cast<float *>(dst + plane_stride);
+        size_t i = 0;
+
+        for (; i + 4 <= frames; i += 4)
+        {
+            __m128 a = _mm_loadu_ps(in + i * 2);
+            __m128 b = _mm_loadu_ps(in + i * 2 + 4);
+            _mm_storeu_ps(left + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+            _mm_storeu_ps(right + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+        }
+        // counted from the first frame left, a loop on i gets gcc 12 to warn about i * 2 overflowing
+        size_t tail = frames - i;
+        in += i * 2;
+        left += i;
+        right += i;
+        for (size_t j = 0; j < tail; j++)
+        {
+            left[j] = in[j * 2];
+            right[j] = in[j * 2 + 1];
+        }
+    }
+
+    __attribute__((target("sse2"))) inline void stereo16(const char *src, char *dst, size_t frames, size_t plane_stride)
+    {
+        const int16_t *in = reinterpret_cast<const int16_t *>(src);
+        int16_t *left = reinterpret_cast<int16_t *>(dst);
+        int16_t *right = reinterpret_cast<int16_t *>(dst + plane_stride);
+        size_t i = 0;
+
+        for (; i + 8 <= frames; i += 8)
+        {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i * 2));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i * 2 + 8));
+            // even samples: sign extend the low halves; odd samples: shift the high halves down
+            __m128i l = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16), _mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+            __m128i r = _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(left + i), l);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(right + i), r);
+        }
+        size_t tail = frames - i;
+        in += i * 2;
+        left += i;
+        right += i;
+        for (size_t j = 0; j < tail; j++)
+        {
+            left[j] = in[j * 2];
+            right[j] = in[j * 2 + 1];
+        }
+    }
+
+    inline bool has_sse2()
+    {
+        return __builtin_cpu_supports("sse2");
+    }
+#endif
+} // namespace deinterleave
+
+inline void deinterleave_frames(const char *src, char *dst, size_t frames, size_t channels, size_t sample_bytes, size_t plane_stride)
+{
+    using namespace deinterleave;
+
+#ifdef DEINTERLEAVE_X86
+    static const bool sse2 = has_sse2();
+    if (channels == 2 && sse2)
+    {
+        if (sample_bytes == 4)
+        {
+            return stereo32(src, dst, frames, plane_stride);
+        }
+        if (sample_bytes == 2)
+        {
+            return stereo16(src, dst, frames, plane_stride);
+        }
+    }
+#endif
+
+    switch (sample_bytes)
+    {
+    case 1:
+        return blocked<uint8_t>(src, dst, frames, channels, plane_stride);
+    case 2:
+        return blocked<uint16_t>(src, dst, frames, channels, plane_stride);
+    case 4:
+        return blocked<uint32_t>(src, dst, frames, channels, plane_stride);
+    case 8:
+        return blocked<uint64_t>(src, dst, frames, channels, plane_stride);
+    default:
+        return blocked_bytes(src, dst, frames, channels, plane_stride, sample_bytes);
+    }
+}
+
+#endif // ____Deinterleave__
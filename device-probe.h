@@ -0,0 +1,275 @@
+#ifndef ____DeviceProbe__
+#define ____DeviceProbe__
+
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define ALSA_PCM_NEW_HW_PARAMS_API
+
+#include <alsa/asoundlib.h>
+
+/*
+ * Device enumeration (snd_device_name_hint) and capability probing
+ * (snd_pcm_hw_params_test_*) for listDevices() and probe(). Both run on the
+ * libuv threadpool; results are cached until the set of sound cards changes.
+ */
+namespace device_probe
+{
+    /* one capture capable PCM of snd_device_name_hint */
+    struct DeviceInfo
+    {
+        std::string name;
+        std::string description;
+    };
+
+    /* what the hw params of a device allow */
+    struct DeviceCaps
+    {
+        DeviceCaps()
+            : card(-1), channels_min(0), channels_max(0), rate_min(0), rate_max(0), period_size_min(0), period_size_max(0),
+              buffer_size_min(0), buffer_size_max(0), mmap(false) {}
+
+        // -1 for plugins that are not bound to a single card
+        int card;
+        unsigned int channels_min;
+        unsigned int channels_max;
+        unsigned int rate_min;
+        unsigned int rate_max;
+        // the common rates within [rate_min, rate_max] the device accepts
+        std::vector<unsigned int> rates;
+        std::vector<std::string> formats;
+        snd_pcm_uframes_t period_size_min;
+        snd_pcm_uframes_t period_size_max;
+        snd_pcm_uframes_t buffer_size_min;
+        snd_pcm_uframes_t buffer_size_max;
+        bool mmap;
+    };
+
+    /* index -> name of every sound card present; changes on hotplug */
+    inline std::map<int, std::string> present_cards()
+    {
+        std::map<int, std::string> cards;
+        int card = -1;
+
+        while (snd_card_next(&card) == 0 && card >= 0)
+        {
+            char *name = NULL;
+            if (snd_card_get_name(card, &name) == 0 && name)
+            {
+                cards[card] = name;
+                free(name);
+            }
+            else
+            {
+                cards[card] = "";
+            }
+        }
+        return cards;
+    }
+
+    inline std::string hint_value(const void *hint, const char *id)
+    {
+        char *value = snd_device_name_get_hint(hint, id);
+        std::string result = value ? value : "";
+        free(value);
+        return result;
+    }
+
+    inline bool list_devices(std::vector<DeviceInfo> &devices, std::string &error)
+    {
+        void **hints;
+        int rc = snd_device_name_hint(-1, "pcm", &hints);
+        if (rc < 0)
+        {
+            error = std::string("Unable to list devices: ") + snd_strerror(rc);
+            return false;
+        }
+
+        for (void **hint = hints; *hint; hint++)
+        {
+            // no IOID means both directions
+            std::string ioid = hint_value(*hint, "IOID");
+            if (!ioid.empty() && ioid != "Input")
+            {
+                continue;
+            }
+
+            DeviceInfo device;
+            device.name = hint_value(*hint, "NAME");
+            device.description = hint_value(*hint, "DESC");
+            if (!device.name.empty() && device.name != "null")
+            {
+                devices.push_back(device);
+            }
+        }
+
+        snd_device_name_free_hint(hints);
+        return true;
+    }
+
+    /* opens device for capture (non-blocking, nothing is configured) and tests what its hw params allow */
+    inline bool probe_device(const std::string &device, DeviceCaps &caps, std::string &error)
+    {
+        static const unsigned int common_rates[] = {8000, 11025, 16000, 22050, 32000, 44100, 48000, 88200, 96000, 176400, 192000, 384000};
+
+        snd_pcm_t *handle;
+        int rc = snd_pcm_open(&handle, device.c_str(), SND_PCM_STREAM_CAPTURE, SND_PCM_NONBLOCK);
+        if (rc < 0)
+        {
+            std::ostringstream probeError;
+            probeError << "Unable to open PCM device: " << snd_strerror(rc);
+            error = probeError.str();
+            return false;
+        }
+
+        snd_pcm_info_t *info;
+        if (snd_pcm_info_malloc(&info) == 0)
+        {
+            if (snd_pcm_info(handle, info) == 0)
+            {
+                caps.card = snd_pcm_info_get_card(info);
+            }
+            snd_pcm_info_free(info);
+        }
+
+        snd_pcm_hw_params_t *params;
+        snd_pcm_hw_params_alloca(&params);
+        rc = snd_pcm_hw_params_any(handle, params);
+        if (rc < 0)
+        {
+            error = std::string("Unable to read HW parameters: ") + snd_strerror(rc);
+            snd_pcm_close(handle);
+            return false;
+        }
+
+        int dir = 0;
+        snd_pcm_hw_params_get_channels_min(params, &caps.channels_min);
+        snd_pcm_hw_params_get_channels_max(params, &caps.channels_max);
+        snd_pcm_hw_params_get_rate_min(params, &caps.rate_min, &dir);
+        snd_pcm_hw_params_get_rate_max(params, &caps.rate_max, &dir);
+        snd_pcm_hw_params_get_period_size_min(params, &caps.period_size_min, &dir);
+        snd_pcm_hw_params_get_period_size_max(params, &caps.period_size_max, &dir);
+        snd_pcm_hw_params_get_buffer_size_min(params, &caps.buffer_size_min);
+        snd_pcm_hw_params_get_buffer_size_max(params, &caps.buffer_size_max);
+        caps.mmap = snd_pcm_hw_params_test_access(handle, params, SND_PCM_ACCESS_MMAP_INTERLEAVED) == 0;
+
+        for (unsigned int rate : common_rates)
+        {
+            if (rate >= caps.rate_min && rate <= caps.rate_max && snd_pcm_hw_params_test_rate(handle, params, rate, 0) == 0)
+            {
+                caps.rates.push_back(rate);
+            }
+        }
+
+        for (int format = 0; format <= SND_PCM_FORMAT_LAST; format++)
+        {
+            snd_pcm_format_t value = static_cast<snd_pcm_format_t>(format);
+            const char *name = snd_pcm_format_name(value);
+            if (name && snd_pcm_hw_params_test_format(handle, params, value) == 0)
+            {
+                caps.formats.push_back(name);
+            }
+        }
+
+        snd_pcm_close(handle);
+        return true;
+    }
+
+    /*
+     * Results of list_devices and probe_device. An entry of a card stays valid
+     * while a card with the same name sits at its index; the device list and
+     * entries of plugins (no single card) are dropped whenever any card comes
+     * or goes.
+     */
+    class ProbeCache
+    {
+    public:
+        bool devices(std::vector<DeviceInfo> &devices, std::string &error, bool refresh)
+        {
+            std::map<int, std::string> cards = present_cards();
+            {
+                std::lock_guard<std::mutex> locker(mu);
+                if (!refresh && has_list && list_cards == cards)
+                {
+                    devices = list;
+                    return true;
+                }
+            }
+
+            if (!list_devices(devices, error))
+            {
+                return false;
+            }
+
+            std::lock_guard<std::mutex> locker(mu);
+            list = devices;
+            list_cards = cards;
+            has_list = true;
+            return true;
+        }
+
+        bool probe(const std::string &device, DeviceCaps &caps, std::string &error, bool refresh)
+        {
+            std::map<int, std::string> cards = present_cards();
+            {
+                std::lock_guard<std::mutex> locker(mu);
+                auto entry = entries.find(device);
+                if (!refresh && entry != entries.end() && valid(entry->second, cards))
+                {
+                    caps = entry->second.caps;
+                    return true;
+                }
+            }
+
+            if (!probe_device(device, caps, error))
+            {
+                return false;
+            }
+
+            Entry entry;
+            entry.caps = caps;
+            entry.cards = cards;
+            std::lock_guard<std::mutex> locker(mu);
+            entries[device] = entry;
+            return true;
+        }
+
+    private:
+        struct Entry
+        {
+            DeviceCaps caps;
+            // present_cards() at probe time
+            std::map<int, std::string> cards;
+        };
+
+        static bool valid(const Entry &entry, const std::map<int, std::string> &cards)
+        {
+            if (entry.caps.card < 0)
+            {
+                return entry.cards == cards;
+            }
+
+            auto then = entry.cards.find(entry.caps.card);
+            auto now = cards.find(entry.caps.card);
+            return then != entry.cards.end() && now != cards.end() && then->second == now->second;
+        }
+
+        std::mutex mu;
+        bool has_list = false;
+        std::vector<DeviceInfo> list;
+        std::map<int, std::string> list_cards;
+        std::map<std::string, Entry> entries;
+    };
+
+    /* shared by all environments of the process; plain data behind mu, results are converted on the caller's thread */
+    inline ProbeCache &cache()
+    {
+        static ProbeCache instance;
+        return instance;
+    }
+} // namespace device_probe
+
+#endif // ____DeviceProbe__
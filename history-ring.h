@@ -0,0 +1,112 @@
+#ifndef ____HistoryRing__
+#define ____HistoryRing__
+
+#include <stdint.h>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+/*
+ * The last frames of a device (historySeconds) for getHistory(). Frames are
+ * numbered like the position of the audio events. The capture thread
+ * appends without ever waiting; a reader copies a range and afterwards
+ * checks that the writer did not overwrite it meanwhile (a seqlock on the
+ * frame counter), retrying with the range moved up if it did.
+ */
+class HistoryRing
+{
+public:
+    /* keeps frames frames; guard frames more are allocated so a write in progress rarely touches what readers are allowed to copy */
+    HistoryRing(size_t frames, size_t guard, size_t frame_bytes)
+        : kept(frames), capacity(frames + guard), frame_bytes(frame_bytes), data(capacity * frame_bytes), reserved(0), end(0) {}
+
+    /* capture thread only */
+    void write(const char *src, size_t frames)
+    {
+        uint64_t pos = end.load(std::memory_order_relaxed);
+        uint64_t new_end = pos + frames;
+
+        // frames that would be overwritten within this very write are skipped
+        if (frames > capacity)
+        {
+            src += (frames - capacity) * frame_bytes;
+            pos = new_end - capacity;
+            frames = capacity;
+        }
+
+        reserved.store(new_end, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        size_t offset = static_cast<size_t>(pos % capacity);
+        size_t first = frames < capacity - offset ? frames : capacity - offset;
+        memcpy(&data[offset * frame_bytes], src, first * frame_bytes);
+        memcpy(&data[0], src + first * frame_bytes, (frames - first) * frame_bytes);
+
+        end.store(new_end, std::memory_order_release);
+    }
+
+    /* oldest and one past the newest frame that can be read */
+    void range(uint64_t &from, uint64_t &to) const
+    {
+        to = end.load(std::memory_order_acquire);
+        from = to > kept ? to - kept : 0;
+    }
+
+    /*
+     * Copies [from, to), clamped to what is kept, to dst (room for the
+     * frames asked for) and returns the range actually copied in from/to.
+     * Any thread.
+     */
+    void read(uint64_t &from, uint64_t &to, char *dst) const
+    {
+        uint64_t want_from = from;
+        uint64_t want_to = to;
+
+        for (int attempt = 0; attempt < max_attempts; attempt++)
+        {
+            uint64_t oldest, newest;
+            range(oldest, newest);
+            from = want_from > oldest ? want_from : oldest;
+            to = want_to < newest ? want_to : newest;
+            if (to <= from)
+            {
+                from = to;
+                return;
+            }
+
+            size_t offset = static_cast<size_t>(from % capacity);
+            size_t frames = static_cast<size_t>(to - from);
+            size_t first = frames < capacity - offset ? frames : capacity - offset;
+            memcpy(dst, &data[offset * frame_bytes], first * frame_bytes);
+            memcpy(dst + first * frame_bytes, &data[0], (frames - first) * frame_bytes);
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (reserved.load(std::memory_order_relaxed) <= from + capacity)
+            {
+                return;
+            }
+        }
+
+        // the writer kept lapping the copy, which only happens with a guard far smaller than a period
+        from = to;
+    }
+
+    size_t frameBytes() const
+    {
+        return frame_bytes;
+    }
+
+private:
+    static const int max_attempts = 4;
+
+    size_t kept;
+    size_t capacity;
+    size_t frame_bytes;
+    std::vector<char> data;
+    // end of the write in progress, and of the frames completely written
+    std::atomic<uint64_t> reserved;
+    std::atomic<uint64_t> end;
+};
+
+#endif // ____HistoryRing__
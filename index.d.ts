@@ -1,29 +1,256 @@
+import { Readable, ReadableOptions } from "stream";
+
 export = AlsaCapture;
 
 declare interface AlsaCapture {
-    on(event: "audio", listener: (data: Uint8Array) => void): this;
+    on(event: "audio", listener: (data: AlsaCaptureAudio, batch: AlsaCaptureBatch) => void): this;
+    on(event: "dropped", listener: (frames: number) => void): this;
+    on(event: "deviceError", listener: (error: string, device: number) => void): this;
+    on(event: "deviceLost", listener: (error: string, device?: number) => void): this;
+    on(event: "deviceReopened" | "suspended" | "resumed", listener: (message: string, device?: number) => void): this;
+    on(event: "deviceShared", listener: (device: string) => void): this;
+    on(event: "accessDeviating", listener: (actualAccess: "rw") => void): this;
     on(event: "close", listener: () => void): this;
     on(event: "error", listener: (error: Error) => void): this;
     on(event: "overrun", listener: () => void): this;
+    on(event: "bufferSizeDeviating", listener: (actualBufferSize: number) => void): this;
+    on(event: "periodsDeviating", listener: (actualPeriods: number) => void): this;
+    on(event: "availMinDeviating", listener: (actualAvailMin: number) => void): this;
+    on(event: "startThresholdDeviating", listener: (actualStartThreshold: number) => void): this;
+    on(
+        event: "latency",
+        listener: (latency: {
+            periodSize: number;
+            periods: number;
+            bufferSize: number;
+            availMin: number;
+            startThreshold: number;
+            periodTime: number;
+            bufferTime: number;
+            firstPeriod: number;
+            delay: number;
+            measured: number;
+        }) => void
+    ): this;
+    on(
+        event: "adapted",
+        listener: (
+            adapted: {
+                reason: "overrun" | "lag" | "stable";
+                periodSize: number;
+                batchPeriods: number;
+                periodTime: number;
+                latency: number;
+            },
+            device?: number
+        ) => void
+    ): this;
+    on(
+        event: "segmentClosed",
+        listener: (
+            segment: { path: string; position: number; frames: number; bytes: number; rate: number; droppedFrames: number },
+            device?: number
+        ) => void
+    ): this;
+    on(event: "recordError", listener: (error: string, device?: number) => void): this;
+    on(event: "gateOpen", listener: (gate: { position: number; trigger: number }, device?: number) => void): this;
+    on(event: "gateClose", listener: (gate: { position: number }, device?: number) => void): this;
+    on(
+        event: "levels",
+        listener: (
+            levels: { rms: number[]; peak: number[]; clipped: number[]; position: number; frames: number },
+            device?: number
+        ) => void
+    ): this;
     on(event: "periodSizeDeviating", listener: (actualPeriodSize: number) => void): this;
     on(event: "periodTime", listener: (periodTime: number) => void): this;
     on(event: "rateDeviating", listener: (actualRate: number) => void): this;
     on(event: "readError", listener: (error: string) => void): this;
     on(event: "shortRead", listener: (framesRead: number) => void): this;
+    on(
+        event: "threadScheduling",
+        listener: (granted: {
+            policy?: "fifo" | "rr" | "other";
+            priority?: number;
+            policyGranted?: boolean;
+            nice?: number;
+            niceGranted?: boolean;
+            affinityGranted?: boolean;
+            mlockGranted?: boolean;
+        }) => void
+    ): this;
 
     on(event: string, listener: Function): this;
 }
 
+type AlsaCaptureSamples = Uint8Array | Float32Array | Int16Array;
+
+// interleaved samples, or one array per channel with layout: "planar"
+type AlsaCaptureAudio = AlsaCaptureSamples | AlsaCaptureSamples[];
+
+declare interface AlsaCaptureBatch {
+    periods: number;
+    frames: number;
+    // ms on the process.hrtime() clock at which the first frame was captured
+    timestamp: number;
+    // frames read from the device before the first frame
+    position: number;
+    // snd_pcm_delay in frames
+    delay: number;
+    device?: number;
+}
+
+declare interface AlsaCaptureDeviceCaps {
+    device: string;
+    // -1 for plugins not bound to a single card
+    card: number;
+    channels: { min: number; max: number };
+    rate: { min: number; max: number };
+    // the common rates (8000 to 384000) within rate the device accepts
+    rates: number[];
+    formats: string[];
+    periodSize: { min: number; max: number };
+    bufferSize: { min: number; max: number };
+    mmap: boolean;
+}
+
+declare interface AlsaCaptureRecordOptions {
+    path: string;
+    container?: "wav" | "raw";
+    segmentSeconds?: number;
+    fsyncInterval?: number;
+    direct?: boolean;
+}
+
+declare interface AlsaCaptureGateOptions {
+    threshold?: number;
+    hangover?: number;
+    preRoll?: number;
+    block?: number;
+}
+
+declare interface AlsaCaptureDeviceOptions {
+    access?: "rw" | "mmap";
+    availMin?: number;
+    bufferSize?: number;
+    channels?: number;
+    device?: string;
+    format?: string;
+    periodSize?: number;
+    periodTime?: number;
+    periods?: number;
+    rate?: number;
+    startThreshold?: number;
+}
+
 declare class AlsaCapture {
     constructor(options?: {
+        access?: "rw" | "mmap";
+        adaptive?: boolean;
+        availMin?: number;
+        bufferSize?: number;
+        channelMap?: number[];
         channels?: number;
+        cpuAffinity?: number | number[];
         debug?: boolean;
+        deliveryInterval?: number;
+        devices?: Array<string | AlsaCaptureDeviceOptions>;
         format?: string;
+        gate?: boolean | AlsaCaptureGateOptions;
+        layout?: "interleaved" | "planar";
+        levels?: boolean;
+        levelsInterval?: number;
+        maxLatency?: number;
+        maxQueuedBytes?: number;
+        maxQueuedFrames?: number;
+        minBatchFrames?: number;
+        minLatency?: number;
+        mix?: number[][];
+        mlock?: boolean;
+        nice?: number;
+        outputFormat?: "f32" | "s16";
+        outputRate?: number;
         periodSize?: number;
         periodTime?: number;
+        periods?: number;
+        poolSize?: number;
+        queuePolicy?: "drop-newest" | "drop-oldest" | "block";
         rate?: number;
+        record?: AlsaCaptureRecordOptions;
+        reopen?: boolean;
+        resample?: "fast" | "medium" | "best";
+        schedPolicy?: "fifo" | "rr" | "other";
+        schedPriority?: number;
+        sharedBuffer?: SharedArrayBuffer;
+        startThreshold?: number;
+        threads?: number;
         device?: string;
+        emitAudio?: boolean;
+        historySeconds?: number;
     });
 
+    static listDevices(options?: { refresh?: boolean }): Promise<Array<{ name: string; description: string }>>;
+
+    static probe(device: string, options?: { refresh?: boolean }): Promise<AlsaCaptureDeviceCaps>;
+
     close(): void;
+
+    // undefined without historySeconds or for a device that could not be opened
+    getHistory(
+        fromFrame: number,
+        toFrame?: number,
+        device?: number
+    ): { data: AlsaCaptureSamples; from: number; to: number } | undefined;
+
+    setEmitAudio(enabled: boolean): void;
+
+    // Buffers, or the audio as emitted with objectMode; while any stream of the instance is full no audio is
+    // dispatched to any listener. Destroying the stream detaches it and closes the capture only with closeOnEnd
+    stream(options?: ReadableOptions & { closeOnEnd?: boolean }): Readable;
+
+    [Symbol.asyncIterator](): AsyncIterator<AlsaCaptureAudio>;
+
+    pause(): void;
+
+    resume(): void;
+
+    poolStats(): {
+        size: number;
+        available: number;
+        exhausted: number;
+    };
+
+    queueStats(): {
+        frames: number;
+        bytes: number;
+        highWaterFrames: number;
+        highWaterBytes: number;
+        droppedFrames: number;
+    };
+
+    stats(): {
+        periods: number;
+        frames: number;
+        overruns: number;
+        shortReads: number;
+        readErrors: number;
+        chunksDelivered: number;
+        bytesDelivered: number;
+        queuedFrames: number;
+        queuedBytes: number;
+        highWaterFrames: number;
+        highWaterBytes: number;
+        droppedFrames: number;
+        // milliseconds from capture to dispatch in JS
+        latency: {
+            count: number;
+            min: number;
+            mean: number;
+            p50: number;
+            p90: number;
+            p99: number;
+            p999: number;
+            max: number;
+        };
+    };
 }
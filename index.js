@@ -1,3 +1,4 @@
+const { Readable } = require("stream");
 const EventEmitter = require("eventemitter3");
 const Capture = require("./build/Release/capture");
 
@@ -5,12 +6,18 @@ class AlsaCapture extends EventEmitter {
     constructor(opts) {
         super();
 
+        // streams that are full right now; audio is dispatched while there are none
+        this.fullStreams = new Set();
+
         this.capture = new Capture.StreamingWorker(
-            ((event, value, binary) => {
-                if (binary) {
-                    this.emit(event, binary);
+            // extra is the batch info of audio events or the device index
+            // of events from a multi device capture
+            ((event, value, payload, extra) => {
+                const data = payload !== undefined ? payload : value;
+                if (extra !== undefined) {
+                    this.emit(event, data, extra);
                 } else {
-                    this.emit(event, value);
+                    this.emit(event, data);
                 }
             }),
             (() => {
@@ -26,6 +33,106 @@ class AlsaCapture extends EventEmitter {
     close() {
         this.capture.closeInput();
     }
+
+    pause() {
+        this.capture.pauseInput();
+    }
+
+    resume() {
+        this.capture.resumeInput();
+    }
+
+    poolStats() {
+        return this.capture.poolStats();
+    }
+
+    queueStats() {
+        return this.capture.queueStats();
+    }
+
+    stats() {
+        return this.capture.stats();
+    }
+
+    getHistory(fromFrame, toFrame, device) {
+        return this.capture.getHistory(fromFrame, toFrame, device);
+    }
+
+    setEmitAudio(enabled) {
+        this.capture.setEmitAudio(enabled);
+    }
+
+    // a Readable of the audio; while it (or any other stream of this capture) is full the native side stops
+    // dispatching audio to every listener and queues up to highWaterMark bytes
+    stream({ objectMode = false, highWaterMark = objectMode ? 16 : 1 << 20, closeOnEnd = false, ...options } = {}) {
+        const capture = this.capture;
+        const full = this.fullStreams;
+        const hold = () => {
+            full.add(readable);
+            capture.setFlowing(false);
+        };
+        const release = () => {
+            if (full.delete(readable) && full.size === 0) {
+                capture.setFlowing(true);
+            }
+        };
+
+        const readable = new Readable({
+            ...options,
+            highWaterMark,
+            objectMode,
+            read: release,
+            destroy: (error, callback) => {
+                this.off("audio", onAudio);
+                this.off("close", onClose);
+                this.off("error", onError);
+                release();
+                if (closeOnEnd) {
+                    this.close();
+                }
+                callback(error);
+            },
+        });
+
+        const onAudio = (data) => {
+            if (!objectMode && Array.isArray(data)) {
+                readable.destroy(new Error("the planar layout needs an objectMode stream"));
+                return;
+            }
+            // typed arrays go out as Buffers over the same memory
+            const chunk = objectMode || Buffer.isBuffer(data) ? data : Buffer.from(data.buffer, data.byteOffset, data.byteLength);
+            if (!readable.push(chunk)) {
+                hold();
+            }
+        };
+        const onClose = () => readable.push(null);
+        const onError = (error) => readable.destroy(error);
+
+        this.on("audio", onAudio);
+        this.on("close", onClose);
+        this.on("error", onError);
+        // nothing is dispatched until the stream is read from
+        full.add(readable);
+        capture.setFlowing(false, objectMode ? undefined : highWaterMark);
+        return readable;
+    }
+
+    [Symbol.asyncIterator]() {
+        return this.stream({ objectMode: true })[Symbol.asyncIterator]();
+    }
+
+    // both run on the libuv threadpool and are cached until a sound card comes or goes
+    static listDevices({ refresh = false } = {}) {
+        return new Promise((resolve, reject) => {
+            Capture.listDevices(refresh, (error, devices) => (error ? reject(error) : resolve(devices)));
+        });
+    }
+
+    static probe(device, { refresh = false } = {}) {
+        return new Promise((resolve, reject) => {
+            Capture.probe(device, refresh, (error, caps) => (error ? reject(error) : resolve(caps)));
+        });
+    }
 }
 
 module.exports = AlsaCapture;
@@ -0,0 +1,272 @@
+#ifndef ____LevelMeter__
+#define ____LevelMeter__
+
+#include <stdint.h>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include "sample-convert.h"
+
+/*
+ * Per channel RMS, peak and clip count over windows of interleaved Float32
+ * or S16 frames, for the "levels" event. Samples are measured in full scale
+ * units (S16 / 32768); a sample at or above clip_level in magnitude counts
+ * as clipped. With 1, 2 or 4 channels every SIMD lane always holds the same
+ * channel, so the kernels need no shuffling; other channel counts take the
+ * scalar loop.
+ */
+class LevelMeter
+{
+public:
+    static constexpr float clip_level = 32767.0f / 32768.0f;
+
+    LevelMeter() : channels(0), window(0), filled(0), input(SAMPLE_OUTPUT_F32) {}
+
+    LevelMeter(size_t channels, size_t window, SampleOutput input)
+        : channels(channels), window(window), filled(0), input(input), sum(channels, 0.0), peak(channels, 0.0f), clips(channels, 0) {}
+
+    bool active() const
+    {
+        return channels > 0;
+    }
+
+    /* adds up to frames frames but never beyond the end of the current window; returns how many were taken */
+    size_t add(const char *data, size_t frames)
+    {
+        size_t n = frames < window - filled ? frames : window - filled;
+        if (input == SAMPLE_OUTPUT_S16)
+        {
+            measure_s16(reinterpret_cast<const int16_t *>(data), n * channels);
+        }
+        else
+        {
+            measure_f32(reinterpret_cast<const float *>(data), n * channels);
+        }
+        filled += n;
+        return n;
+    }
+
+    bool complete() const
+    {
+        return filled >= window;
+    }
+
+    /* the levels of the window so far, then starts the next one */
+    void take(std::vector<double> &rms, std::vector<double> &peaks, std::vector<double> &clipped)
+    {
+        rms.resize(channels);
+        peaks.resize(channels);
+        clipped.resize(channels);
+        for (size_t c = 0; c < channels; c++)
+        {
+            rms[c] = filled > 0 ? std::sqrt(sum[c] / filled) : 0.0;
+            peaks[c] = peak[c];
+            clipped[c] = static_cast<double>(clips[c]);
+            sum[c] = 0.0;
+            peak[c] = 0.0f;
+            clips[c] = 0;
+        }
+        filled = 0;
+    }
+
+    size_t frames() const
+    {
+        return filled;
+    }
+
+private:
+    /* lane sums of one call; lane l belongs to channel l % channels */
+    struct Lanes
+    {
+        float sum[4];
+        float peak[4];
+        uint32_t clips[4];
+    };
+
+    void collect(const Lanes &lanes)
+    {
+        for (size_t l = 0; l < 4; l++)
+        {
+            size_t c = l % channels;
+            sum[c] += lanes.sum[l];
+            peak[c] = lanes.peak[l] > peak[c] ? lanes.peak[l] : peak[c];
+            clips[c] += lanes.clips[l];
+        }
+    }
+
+    void scalar(float sample, size_t c)
+    {
+        float magnitude = std::fabs(sample);
+        sum[c] += static_cast<double>(sample) * sample;
+        peak[c] = magnitude > peak[c] ? magnitude : peak[c];
+        clips[c] += magnitude >= clip_level ? 1 : 0;
+    }
+
+    bool lanesMatch() const
+    {
+        return channels == 1 || channels == 2 || channels == 4;
+    }
+
+    void measure_f32(const float *in, size_t samples)
+    {
+        size_t i = 0;
+#if defined(SAMPLE_CONVERT_X86)
+        static const bool sse2 = sample_convert::has_sse2();
+        if (sse2 && lanesMatch())
+        {
+            Lanes lanes;
+            i = samples & ~static_cast<size_t>(3);
+            f32_sse2(in, i, lanes);
+            collect(lanes);
+        }
+#elif defined(SAMPLE_CONVERT_NEON)
+        if (lanesMatch())
+        {
+            Lanes lanes;
+            i = samples & ~static_cast<size_t>(3);
+            f32_neon(in, i, lanes);
+            collect(lanes);
+        }
+#endif
+        for (; i < samples; i++)
+        {
+            scalar(in[i], i % channels);
+        }
+    }
+
+    void measure_s16(const int16_t *in, size_t samples)
+    {
+        size_t i = 0;
+#if defined(SAMPLE_CONVERT_X86)
+        static const bool sse2 = sample_convert::has_sse2();
+        if (sse2 && lanesMatch())
+        {
+            Lanes lanes;
+            i = samples & ~static_cast<size_t>(7);
+            s16_sse2(in, i, lanes);
+            collect(lanes);
+        }
+#elif defined(SAMPLE_CONVERT_NEON)
+        if (lanesMatch())
+        {
+            Lanes lanes;
+            i = samples & ~static_cast<size_t>(7);
+            s16_neon(in, i, lanes);
+            collect(lanes);
+        }
+#endif
+        for (; i < samples; i++)
+        {
+            scalar(in[i] * sample_convert::int16_scale, i % channels);
+        }
+    }
+
+#ifdef SAMPLE_CONVERT_X86
+    struct Sse2State
+    {
+        __m128 sum;
+        __m128 peak;
+        __m128i clips;
+    };
+
+    __attribute__((target("sse2"))) static inline void step_sse2(Sse2State &state, __m128 v)
+    {
+        const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+        __m128 magnitude = _mm_and_ps(v, abs_mask);
+        state.sum = _mm_add_ps(state.sum, _mm_mul_ps(v, v));
+        state.peak = _mm_max_ps(state.peak, magnitude);
+        // the compare mask is -1 per clipped lane
+        state.clips = _mm_sub_epi32(state.clips, _mm_castps_si128(_mm_cmpge_ps(magnitude, _mm_set1_ps(clip_level))));
+    }
+
+    __attribute__((target("sse2"))) static inline void store_sse2(const Sse2State &state, Lanes &lanes)
+    {
+        _mm_storeu_ps(lanes.sum, state.sum);
+        _mm_storeu_ps(lanes.peak, state.peak);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes.clips), state.clips);
+    }
+
+    __attribute__((target("sse2"))) static void f32_sse2(const float *in, size_t samples, Lanes &lanes)
+    {
+        Sse2State state = {_mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_si128()};
+        for (size_t i = 0; i < samples; i += 4)
+        {
+            step_sse2(state, _mm_loadu_ps(in + i));
+        }
+        store_sse2(state, lanes);
+    }
+
+    __attribute__((target("sse2"))) static void s16_sse2(const int16_t *in, size_t samples, Lanes &lanes)
+    {
+        const __m128 scale = _mm_set1_ps(sample_convert::int16_scale);
+        Sse2State state = {_mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_si128()};
+        for (size_t i = 0; i < samples; i += 8)
+        {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+            // sign extend by placing each sample in the high half, then shifting down
+            __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+            __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+            step_sse2(state, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+            step_sse2(state, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+        }
+        store_sse2(state, lanes);
+    }
+#endif
+
+#ifdef SAMPLE_CONVERT_NEON
+    struct NeonState
+    {
+        float32x4_t sum;
+        float32x4_t peak;
+        uint32x4_t clips;
+    };
+
+    static inline void step_neon(NeonState &state, float32x4_t v)
+    {
+        float32x4_t magnitude = vabsq_f32(v);
+        state.sum = vmlaq_f32(state.sum, v, v);
+        state.peak = vmaxq_f32(state.peak, magnitude);
+        state.clips = vsubq_u32(state.clips, vcgeq_f32(magnitude, vdupq_n_f32(clip_level)));
+    }
+
+    static inline void store_neon(const NeonState &state, Lanes &lanes)
+    {
+        vst1q_f32(lanes.sum, state.sum);
+        vst1q_f32(lanes.peak, state.peak);
+        vst1q_u32(lanes.clips, state.clips);
+    }
+
+    static void f32_neon(const float *in, size_t samples, Lanes &lanes)
+    {
+        NeonState state = {vdupq_n_f32(0.0f), vdupq_n_f32(0.0f), vdupq_n_u32(0)};
+        for (size_t i = 0; i < samples; i += 4)
+        {
+            step_neon(state, vld1q_f32(in + i));
+        }
+        store_neon(state, lanes);
+    }
+
+    static void s16_neon(const int16_t *in, size_t samples, Lanes &lanes)
+    {
+        NeonState state = {vdupq_n_f32(0.0f), vdupq_n_f32(0.0f), vdupq_n_u32(0)};
+        for (size_t i = 0; i < samples; i += 8)
+        {
+            int16x8_t v = vld1q_s16(in + i);
+            step_neon(state, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), sample_convert::int16_scale));
+            step_neon(state, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), sample_convert::int16_scale));
+        }
+        store_neon(state, lanes);
+    }
+#endif
+
+    size_t channels;
+    size_t window;
+    size_t filled;
+    SampleOutput input;
+    std::vector<double> sum;
+    std::vector<float> peak;
+    std::vector<uint64_t> clips;
+};
+
+#endif // ____LevelMeter__
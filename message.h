@@ -0,0 +1,61 @@
+#ifndef ____Message__
+#define ____Message__
+#include <string>
+#include <vector>
+
+// a named value of a structured event; delivered to JS as one object
+struct MessageField
+{
+  enum Type
+  {
+    NUMBER,
+    BOOLEAN,
+    STRING,
+    ARRAY
+  };
+
+  std::string key;
+  Type type;
+  double number;
+  std::string text;
+  std::vector<double> values;
+};
+
+class Message
+{
+public:
+  std::string name;
+  std::string data;
+  std::string binary;
+  std::vector<MessageField> fields;
+  // index into the devices option, -1 for a single device capture
+  int device;
+  Message(std::string name, std::string data, std::string binary) : name(name), data(data), binary(binary), device(-1) {}
+
+  Message &set(const std::string &key, double value)
+  {
+    fields.push_back({key, MessageField::NUMBER, value, "", {}});
+    return *this;
+  }
+
+  Message &setBool(const std::string &key, bool value)
+  {
+    fields.push_back({key, MessageField::BOOLEAN, value ? 1.0 : 0.0, "", {}});
+    return *this;
+  }
+
+  Message &setString(const std::string &key, const std::string &value)
+  {
+    fields.push_back({key, MessageField::STRING, 0, value, {}});
+    return *this;
+  }
+
+  // delivered as an Array of numbers
+  Message &setArray(const std::string &key, const std::vector<double> &values)
+  {
+    fields.push_back({key, MessageField::ARRAY, 0, "", values});
+    return *this;
+  }
+};
+
+#endif // ____Message__
@@ -0,0 +1,453 @@
+#ifndef ____PcmDevice__
+#define ____PcmDevice__
+
+#include <poll.h>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define ALSA_PCM_NEW_HW_PARAMS_API
+
+#include <alsa/asoundlib.h>
+
+#include "capture-stats.h"
+#include "message.h"
+
+/* Requested hardware parameters of one capture device */
+struct PcmConfig
+{
+    PcmConfig()
+        : device("default"), channels(2), format(SND_PCM_FORMAT_S16_LE), period_size(32), period_time(0), rate(44100), mmap(false),
+          buffer_size(0), periods(0), avail_min(0), start_threshold(0) {}
+
+    std::string device;
+    int channels;
+    _snd_pcm_format format;
+    int period_size;
+    int period_time;
+    int rate;
+    // try SND_PCM_ACCESS_MMAP_INTERLEAVED before RW_INTERLEAVED
+    bool mmap;
+    // ring buffer and sw params; 0 leaves the driver's choice
+    int buffer_size;
+    int periods;
+    int avail_min;
+    int start_threshold;
+};
+
+/*
+ * An opened and configured ALSA capture handle plus the parameters the driver
+ * actually granted. Used by the single device capture and by the multi device
+ * engine alike.
+ */
+class PcmDevice
+{
+public:
+    explicit PcmDevice(const PcmConfig &config)
+        : config(config), handle(NULL), mmap(false), timestamps(false), actual_rate(0), frames(0), actual_period_time(0),
+          buffer_size(0), periods(0), avail_min(0), start_threshold(0), period_bytes(0), frame_bytes(0) {}
+
+    ~PcmDevice()
+    {
+        close();
+    }
+
+    /*
+     * Opens the device and negotiates the hw params. Deviations from the
+     * requested parameters are appended to notices as events for JS.
+     */
+    bool open(bool nonblock, bool debug, std::vector<Message> &notices, std::string &error)
+    {
+        int rc;
+        snd_pcm_hw_params_t *params;
+        unsigned int val;
+        int dir = 0;
+
+        rc = snd_pcm_open(&handle, config.device.c_str(), SND_PCM_STREAM_CAPTURE, nonblock ? SND_PCM_NONBLOCK : 0);
+
+        if (rc < 0)
+        {
+            handle = NULL;
+            std::ostringstream pcmDeviceError;
+            pcmDeviceError << "Unable to open PCM device: " << snd_strerror(rc) << "\n";
+            error = pcmDeviceError.str();
+            return false;
+        }
+
+        /* Allocate a hardware parameters object. */
+        snd_pcm_hw_params_alloca(&params);
+
+        /* Fill it in with default values. */
+        snd_pcm_hw_params_any(handle, params);
+
+        /* Set the desired hardware parameters. */
+
+        /* Interleaved mode; mmap if requested and the device/plugin supports it */
+        mmap = config.mmap &&
+               snd_pcm_hw_params_set_access(handle, params, SND_PCM_ACCESS_MMAP_INTERLEAVED) == 0;
+        if (!mmap)
+        {
+            snd_pcm_hw_params_set_access(handle, params, SND_PCM_ACCESS_RW_INTERLEAVED);
+        }
+        if (config.mmap && !mmap)
+        {
+            if (debug)
+            {
+                fprintf(stderr, "mmap access refused, falling back to rw\n");
+            }
+            notices.push_back(Message("accessDeviating", "rw", ""));
+        }
+
+        snd_pcm_hw_params_set_format(handle, params, config.format);
+
+        snd_pcm_hw_params_set_channels(handle, params, config.channels);
+
+        val = static_cast<unsigned int>(config.rate);
+        if (debug)
+        {
+            fprintf(stderr, "Rate: %d\n", val);
+        }
+        snd_pcm_hw_params_set_rate_near(handle, params, &val, &dir);
+
+        frames = config.period_size;
+        snd_pcm_hw_params_set_period_size_near(handle, params, &frames, &dir);
+
+        auto frames_time = static_cast<unsigned int>(config.period_time);
+
+        if (frames_time > 0)
+        {
+            if (debug)
+            {
+                fprintf(stderr, "Set period time near: %d\n", config.period_time);
+            }
+            snd_pcm_hw_params_set_period_time_near(handle, params, &frames_time, &dir);
+        }
+
+        /* The ring buffer: number of periods and/or total size */
+        if (config.periods > 0)
+        {
+            unsigned int periods_near = static_cast<unsigned int>(config.periods);
+            snd_pcm_hw_params_set_periods_near(handle, params, &periods_near, &dir);
+        }
+
+        if (config.buffer_size > 0)
+        {
+            snd_pcm_uframes_t buffer_size_near = static_cast<snd_pcm_uframes_t>(config.buffer_size);
+            snd_pcm_hw_params_set_buffer_size_near(handle, params, &buffer_size_near);
+        }
+
+        /* Write the parameters to the driver */
+        rc = snd_pcm_hw_params(handle, params);
+
+        if (rc < 0)
+        {
+            std::ostringstream hwError;
+            hwError << "Unable to set HW parameters: " << snd_strerror(rc) << "\n";
+            error = hwError.str();
+            close();
+            return false;
+        }
+
+        snd_pcm_hw_params_get_rate(params, &actual_rate, &dir);
+        if (static_cast<unsigned int>(config.rate) != actual_rate)
+        {
+            if (debug)
+            {
+                fprintf(stderr, "Requested rate != actual rate: %d != %u\n", config.rate, actual_rate);
+            }
+            notices.push_back(Message("rateDeviating", std::to_string(actual_rate), ""));
+        }
+
+        snd_pcm_hw_params_get_period_size(params, &frames, &dir);
+        if (frames != static_cast<unsigned long>(config.period_size))
+        {
+            if (debug)
+            {
+                fprintf(stderr, "Requested period size != actual period size: %d != %lu\n", config.period_size, frames);
+            }
+            notices.push_back(Message("periodSizeDeviating", std::to_string(frames), ""));
+        }
+
+        snd_pcm_hw_params_get_period_time(params, &actual_period_time, &dir);
+        if (debug)
+        {
+            fprintf(stderr, "Actual period time: %u\n", actual_period_time);
+        }
+        notices.push_back(Message("periodTime", std::to_string(actual_period_time), ""));
+
+        snd_pcm_hw_params_get_buffer_size(params, &buffer_size);
+        if (config.buffer_size > 0 && buffer_size != static_cast<snd_pcm_uframes_t>(config.buffer_size))
+        {
+            if (debug)
+            {
+                fprintf(stderr, "Requested buffer size != actual buffer size: %d != %lu\n", config.buffer_size, buffer_size);
+            }
+            notices.push_back(Message("bufferSizeDeviating", std::to_string(buffer_size), ""));
+        }
+
+        snd_pcm_hw_params_get_periods(params, &periods, &dir);
+        if (config.periods > 0 && periods != static_cast<unsigned int>(config.periods))
+        {
+            if (debug)
+            {
+                fprintf(stderr, "Requested periods != actual periods: %d != %u\n", config.periods, periods);
+            }
+            notices.push_back(Message("periodsDeviating", std::to_string(periods), ""));
+        }
+
+        if (!setSwParams(debug, notices, error))
+        {
+            close();
+            return false;
+        }
+
+        frame_bytes = (config.channels * snd_pcm_format_physical_width(config.format)) / 8;
+        period_bytes = frames * frame_bytes;
+
+        if (debug)
+        {
+            fprintf(stderr, "Actual rate: %d\n", actual_rate);
+            fprintf(stderr, "Buffer size: %zu\n", period_bytes);
+        }
+
+        return true;
+    }
+
+    /*
+     * Hardware timestamps on the monotonic clock (for the latency statistics)
+     * plus availMin and startThreshold. Only fails if one of those two was
+     * requested and the driver refused the sw params.
+     */
+    bool setSwParams(bool debug, std::vector<Message> &notices, std::string &error)
+    {
+        snd_pcm_sw_params_t *sw_params;
+        snd_pcm_sw_params_alloca(&sw_params);
+
+        int rc = snd_pcm_sw_params_current(handle, sw_params);
+        timestamps = rc == 0 &&
+                     snd_pcm_sw_params_set_tstamp_mode(handle, sw_params, SND_PCM_TSTAMP_ENABLE) == 0 &&
+                     snd_pcm_sw_params_set_tstamp_type(handle, sw_params, SND_PCM_TSTAMP_TYPE_MONOTONIC) == 0;
+
+        if (rc == 0 && config.avail_min > 0)
+        {
+            snd_pcm_sw_params_set_avail_min(handle, sw_params, static_cast<snd_pcm_uframes_t>(config.avail_min));
+        }
+        if (rc == 0 && config.start_threshold > 0)
+        {
+            snd_pcm_sw_params_set_start_threshold(handle, sw_params, static_cast<snd_pcm_uframes_t>(config.start_threshold));
+        }
+
+        if (rc == 0)
+        {
+            rc = snd_pcm_sw_params(handle, sw_params);
+        }
+        if (rc < 0)
+        {
+            timestamps = false;
+            if (config.avail_min > 0 || config.start_threshold > 0)
+            {
+                std::ostringstream swError;
+                swError << "Unable to set SW parameters: " << snd_strerror(rc) << "\n";
+                error = swError.str();
+                return false;
+            }
+        }
+
+        if (debug && !timestamps)
+        {
+            fprintf(stderr, "No monotonic hardware timestamps, using the time of the read\n");
+        }
+        if (rc < 0)
+        {
+            return true;
+        }
+
+        snd_pcm_sw_params_get_avail_min(sw_params, &avail_min);
+        if (config.avail_min > 0 && avail_min != static_cast<snd_pcm_uframes_t>(config.avail_min))
+        {
+            notices.push_back(Message("availMinDeviating", std::to_string(avail_min), ""));
+        }
+
+        snd_pcm_sw_params_get_start_threshold(sw_params, &start_threshold);
+        if (config.start_threshold > 0 && start_threshold != static_cast<snd_pcm_uframes_t>(config.start_threshold))
+        {
+            notices.push_back(Message("startThresholdDeviating", std::to_string(start_threshold), ""));
+        }
+
+        return true;
+    }
+
+    void close()
+    {
+        if (handle)
+        {
+            // drain only makes sense for playback and may block
+            snd_pcm_drop(handle);
+            snd_pcm_close(handle);
+            handle = NULL;
+        }
+    }
+
+    /* (re)starts the stream after open or after an overrun */
+    int start()
+    {
+        int rc = 0;
+        if (snd_pcm_state(handle) != SND_PCM_STATE_PREPARED)
+        {
+            rc = snd_pcm_prepare(handle);
+        }
+        return rc < 0 ? rc : snd_pcm_start(handle);
+    }
+
+    /* stops right away, dropping what is buffered; the device stays configured and prepared for start() */
+    int stop()
+    {
+        int rc = snd_pcm_drop(handle);
+        return rc < 0 ? rc : snd_pcm_prepare(handle);
+    }
+
+    /* after snd_pcm_recover the device is prepared again, capture needs the explicit start */
+    int recover(int err)
+    {
+        int rc = snd_pcm_recover(handle, err, 1);
+        return rc < 0 ? rc : start();
+    }
+
+    /* -EAGAIN while a suspended device is still waking up; devices that cannot resume are prepared and started */
+    int resume()
+    {
+        int rc = snd_pcm_resume(handle);
+        if (rc == -EAGAIN)
+        {
+            return rc;
+        }
+        return rc < 0 ? start() : rc;
+    }
+
+    /* rw access: reads up to count frames into dst */
+    snd_pcm_sframes_t read(char *dst, snd_pcm_uframes_t count)
+    {
+        return snd_pcm_readi(handle, dst, count);
+    }
+
+    /*
+     * mmap access: hands up to count frames to consume(src, offset, n) straight
+     * from the DMA area, where offset counts frames already consumed in this
+     * call. The area may wrap, so consume can be called more than once.
+     * Returns the frames consumed or a negative error code.
+     */
+    template <typename Consume>
+    snd_pcm_sframes_t readMapped(snd_pcm_uframes_t count, Consume consume)
+    {
+        snd_pcm_uframes_t done = 0;
+
+        while (done < count)
+        {
+            const snd_pcm_channel_area_t *areas;
+            snd_pcm_uframes_t offset;
+            snd_pcm_uframes_t available = count - done;
+
+            int rc = snd_pcm_mmap_begin(handle, &areas, &offset, &available);
+            if (rc < 0)
+            {
+                return rc;
+            }
+            if (available == 0)
+            {
+                break;
+            }
+
+            const char *src = static_cast<const char *>(areas[0].addr) + areas[0].first / 8 + offset * (areas[0].step / 8);
+            consume(src, done, available);
+
+            snd_pcm_sframes_t committed = snd_pcm_mmap_commit(handle, offset, available);
+            if (committed < 0)
+            {
+                return committed;
+            }
+            if (static_cast<snd_pcm_uframes_t>(committed) != available)
+            {
+                return -EPIPE;
+            }
+            done += available;
+        }
+
+        return done > 0 ? static_cast<snd_pcm_sframes_t>(done) : -EAGAIN;
+    }
+
+    /*
+     * CLOCK_MONOTONIC time (ns) at which the newest frame read so far was
+     * captured: the last hardware pointer update minus the frames that were
+     * still waiting at that moment. Falls back to the current time.
+     */
+    int64_t captureTime()
+    {
+        snd_pcm_uframes_t avail;
+        snd_htimestamp_t ts;
+
+        if (handle && timestamps && snd_pcm_htimestamp(handle, &avail, &ts) == 0 && (ts.tv_sec != 0 || ts.tv_nsec != 0))
+        {
+            int64_t updated = static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+            return updated - static_cast<int64_t>(avail) * 1000000000 / actual_rate;
+        }
+        return monotonic_ns();
+    }
+
+    /* frames captured but not read yet (including what the hardware still holds), 0 if unknown */
+    snd_pcm_sframes_t delay()
+    {
+        snd_pcm_sframes_t frames_delay = 0;
+        return handle && snd_pcm_delay(handle, &frames_delay) == 0 ? frames_delay : 0;
+    }
+
+    /* appends this device's poll descriptors to fds */
+    void pollDescriptors(std::vector<struct pollfd> &fds)
+    {
+        if (!handle)
+        {
+            return;
+        }
+
+        int count = snd_pcm_poll_descriptors_count(handle);
+        if (count <= 0)
+        {
+            return;
+        }
+
+        size_t offset = fds.size();
+        fds.resize(offset + count);
+        count = snd_pcm_poll_descriptors(handle, &fds[offset], count);
+        fds.resize(offset + (count > 0 ? count : 0));
+    }
+
+    /* translates the revents of this device's descriptors (starting at fds) */
+    unsigned short pollRevents(struct pollfd *fds, unsigned int count)
+    {
+        unsigned short revents = 0;
+        if (!handle || count == 0)
+        {
+            return 0;
+        }
+        snd_pcm_poll_descriptors_revents(handle, fds, count, &revents);
+        return revents;
+    }
+
+    PcmConfig config;
+    snd_pcm_t *handle;
+    // granted access: mmap or rw
+    bool mmap;
+    // hardware timestamps on CLOCK_MONOTONIC enabled
+    bool timestamps;
+    unsigned int actual_rate;
+    snd_pcm_uframes_t frames;
+    unsigned int actual_period_time;
+    // granted ring buffer and sw params, in frames (periods: count)
+    snd_pcm_uframes_t buffer_size;
+    unsigned int periods;
+    snd_pcm_uframes_t avail_min;
+    snd_pcm_uframes_t start_threshold;
+    size_t period_bytes;
+    size_t frame_bytes;
+};
+
+#endif // ____PcmDevice__
@@ -0,0 +1,522 @@
+#ifndef ____Recorder__
+#define ____Recorder__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+
+#define ALSA_PCM_NEW_HW_PARAMS_API
+
+#include <alsa/asoundlib.h>
+
+#include "buffer-pool.h"
+#include "spsc-ring.h"
+#include "streaming-worker.h"
+
+/* the record option */
+struct RecordConfig
+{
+    RecordConfig() : wav(true), segment_seconds(0), fsync_interval(5), direct(false) {}
+
+    std::string path;
+    // container: WAV, or the bare samples
+    bool wav;
+    // 0 writes a single file
+    int segment_seconds;
+    // seconds between two fdatasync of the open segment, 0 syncs on close only
+    int fsync_interval;
+    // O_DIRECT where the filesystem supports it
+    bool direct;
+};
+
+/* a file the recorder finished */
+struct RecordSegment
+{
+    RecordSegment() : position(0), frames(0), bytes(0), rate(0), dropped(0) {}
+
+    std::string path;
+    // frame number of the first frame, as in the audio events
+    uint64_t position;
+    uint64_t frames;
+    // audio bytes, without the header
+    uint64_t bytes;
+    unsigned int rate;
+    // frames lost while this segment was open because the writer fell behind
+    uint64_t dropped;
+};
+
+/*
+ * Writes the audio of one device to disk on a thread of its own, for the
+ * record option. The capture thread hands over full batches with push()
+ * (a lock-free ring, the same chunks that would otherwise go to JS); the
+ * writer copies them into a large block aligned staging buffer, writes it
+ * out in whole blocks and hands the pooled buffers back. Segments rotate
+ * after segment_seconds of frames, or when the rate changes; a WAV header
+ * is written with placeholder sizes and patched when its segment closes.
+ *
+ * The writer is the only thread releasing buffers to the pool, as none
+ * reach JS while recording.
+ */
+class Recorder
+{
+public:
+    typedef std::function<void(const RecordSegment &)> SegmentCallback;
+    typedef std::function<void(const std::string &)> ErrorCallback;
+
+    static const size_t staging_size = 1 << 20;
+    static const size_t block_size = 4096;
+    static const size_t wav_header_size = 44;
+
+    /* formats a plain PCM/float WAV header can describe */
+    static bool wavSupported(snd_pcm_format_t format)
+    {
+        switch (format)
+        {
+        case SND_PCM_FORMAT_U8:
+        case SND_PCM_FORMAT_S16_LE:
+        case SND_PCM_FORMAT_S24_3LE:
+        case SND_PCM_FORMAT_S32_LE:
+        case SND_PCM_FORMAT_FLOAT_LE:
+        case SND_PCM_FORMAT_FLOAT64_LE:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    /* device is the index of the devices entry (-1 for a single device), it goes into the file names */
+    Recorder(const RecordConfig &config, int device, snd_pcm_format_t format, size_t channels, size_t capacity,
+             SegmentCallback on_segment, ErrorCallback on_error)
+        : config(config), device(device), format(format), channels(channels), on_segment(on_segment), on_error(on_error),
+          entries(capacity), stopping(false), dropped(0), fd(-1), direct(false), staging(NULL), staged(0), written(0), index(0),
+          open_failed(false), last_sync(0)
+    {
+        frame_bytes = channels * snd_pcm_format_physical_width(format) / 8;
+        wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+        void *buffer = NULL;
+        if (posix_memalign(&buffer, block_size, staging_size) != 0)
+        {
+            throw std::bad_alloc();
+        }
+        staging = static_cast<char *>(buffer);
+
+        writer = std::thread([this]() { run(); });
+    }
+
+    ~Recorder()
+    {
+        stop();
+        free(staging);
+        if (wake_fd >= 0)
+        {
+            ::close(wake_fd);
+        }
+    }
+
+    /* capture thread; false (the buffer stays with the caller) if the writer is too far behind */
+    bool push(const AudioChunk &chunk, unsigned int rate)
+    {
+        Entry entry = {chunk, rate};
+        if (!entries.push(entry))
+        {
+            dropped.fetch_add(chunk.meta.frames, std::memory_order_relaxed);
+            return false;
+        }
+        signal();
+        return true;
+    }
+
+    /* writes what was pushed, closes the open segment and joins the writer */
+    void stop()
+    {
+        if (!writer.joinable())
+        {
+            return;
+        }
+        stopping.store(true, std::memory_order_release);
+        signal();
+        writer.join();
+    }
+
+private:
+    struct Entry
+    {
+        AudioChunk chunk;
+        unsigned int rate;
+    };
+
+    void signal()
+    {
+        uint64_t one = 1;
+        if (::write(wake_fd, &one, sizeof(one)) < 0)
+        {
+            // the counter is already non-zero, the writer wakes up anyway
+        }
+    }
+
+    void run()
+    {
+        while (true)
+        {
+            bool stop = stopping.load(std::memory_order_acquire);
+
+            Entry entry;
+            while (entries.pop(entry))
+            {
+                writeEntry(entry);
+            }
+            if (stop)
+            {
+                break;
+            }
+
+            int timeout = -1;
+            if (fd >= 0 && config.fsync_interval > 0)
+            {
+                int64_t due = last_sync + static_cast<int64_t>(config.fsync_interval) * 1000000000LL - now();
+                if (due <= 0)
+                {
+                    sync();
+                    due = static_cast<int64_t>(config.fsync_interval) * 1000000000LL;
+                }
+                timeout = static_cast<int>(due / 1000000) + 1;
+            }
+
+            struct pollfd pfd = {wake_fd, POLLIN, 0};
+            if (poll(&pfd, 1, timeout) > 0)
+            {
+                uint64_t count;
+                if (read(wake_fd, &count, sizeof(count)) < 0)
+                {
+                    // nothing to drain
+                }
+            }
+        }
+
+        closeSegment();
+    }
+
+    void writeEntry(const Entry &entry)
+    {
+        const AudioChunk &chunk = entry.chunk;
+        if (fd >= 0 && entry.rate != segment.rate)
+        {
+            closeSegment();
+        }
+
+        const char *data = chunk.buffer;
+        uint64_t frames = chunk.meta.frames;
+        uint64_t position = chunk.meta.position;
+        uint64_t segment_frames = static_cast<uint64_t>(config.segment_seconds) * entry.rate;
+        uint64_t wav_frames = (0xffffffffULL - wav_header_size) / frame_bytes;
+
+        while (frames > 0)
+        {
+            // frames that cannot be written are reported by the next segmentClosed
+            if (fd < 0 && !openSegment(position, entry.rate))
+            {
+                dropped.fetch_add(frames, std::memory_order_relaxed);
+                break;
+            }
+
+            uint64_t n = frames;
+            if (segment_frames > 0)
+            {
+                n = std::min(n, segment_frames - segment.frames);
+            }
+            if (config.wav)
+            {
+                // the sizes in the header are 32 bit
+                n = std::min(n, wav_frames - segment.frames);
+            }
+
+            if (!stage(data, static_cast<size_t>(n * frame_bytes)))
+            {
+                dropped.fetch_add(frames, std::memory_order_relaxed);
+                closeSegment();
+                break;
+            }
+            segment.frames += n;
+            segment.bytes += n * frame_bytes;
+            data += n * frame_bytes;
+            frames -= n;
+            position += n;
+
+            if ((segment_frames > 0 && segment.frames >= segment_frames) || (config.wav && segment.frames >= wav_frames))
+            {
+                closeSegment();
+            }
+        }
+
+        chunk.pool->release(chunk.buffer);
+    }
+
+    bool openSegment(uint64_t position, unsigned int rate)
+    {
+        std::string path = segmentPath();
+        int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+        direct = false;
+        fd = -1;
+        if (config.direct)
+        {
+            // filesystems without O_DIRECT (tmpfs) refuse the open, they get buffered writes
+            fd = ::open(path.c_str(), flags | O_DIRECT, 0644);
+            direct = fd >= 0;
+        }
+        if (fd < 0)
+        {
+            fd = ::open(path.c_str(), flags, 0644);
+        }
+        if (fd < 0)
+        {
+            // reported once until a segment opens again
+            if (!open_failed)
+            {
+                on_error("Unable to open " + path + ": " + strerror(errno));
+            }
+            open_failed = true;
+            return false;
+        }
+
+        open_failed = false;
+        index++;
+        segment = RecordSegment();
+        segment.path = path;
+        segment.position = position;
+        segment.rate = rate;
+        staged = 0;
+        written = 0;
+        last_sync = now();
+
+        if (config.wav)
+        {
+            header(staging, rate, 0);
+            staged = wav_header_size;
+        }
+        return true;
+    }
+
+    /* file name of the next segment: path, numbered before its extension when there is more than one file */
+    std::string segmentPath() const
+    {
+        if (config.segment_seconds == 0 && device < 0 && index == 0)
+        {
+            return config.path;
+        }
+
+        std::string stem = config.path;
+        std::string extension;
+        size_t dot = config.path.find_last_of('.');
+        size_t slash = config.path.find_last_of('/');
+        if (dot != std::string::npos && dot > 0 && (slash == std::string::npos || dot > slash + 1))
+        {
+            stem = config.path.substr(0, dot);
+            extension = config.path.substr(dot);
+        }
+
+        std::string name = stem;
+        if (device >= 0)
+        {
+            name += "-" + std::to_string(device);
+        }
+        if (config.segment_seconds > 0 || index > 0)
+        {
+            char number[16];
+            snprintf(number, sizeof(number), "-%06u", index);
+            name += number;
+        }
+        return name + extension;
+    }
+
+    /* copies bytes to the staging buffer, writing it out whenever it is full */
+    bool stage(const char *data, size_t bytes)
+    {
+        while (bytes > 0)
+        {
+            size_t n = std::min(bytes, staging_size - staged);
+            memcpy(staging + staged, data, n);
+            staged += n;
+            data += n;
+            bytes -= n;
+
+            if (staged == staging_size && !flush(staging_size))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /* writes the first bytes of the staging buffer and moves the rest to its start */
+    bool flush(size_t bytes)
+    {
+        size_t done = 0;
+        while (done < bytes)
+        {
+            ssize_t rc = ::write(fd, staging + done, bytes - done);
+            if (rc < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (rc <= 0)
+            {
+                on_error("Unable to write " + segment.path + ": " + strerror(rc < 0 ? errno : ENOSPC));
+                staged = 0;
+                return false;
+            }
+            done += rc;
+        }
+
+        written += bytes;
+        memmove(staging, staging + bytes, staged - bytes);
+        staged -= bytes;
+        return true;
+    }
+
+    /* fsyncInterval: writes what is staged (whole blocks only with O_DIRECT) and syncs */
+    void sync()
+    {
+        size_t bytes = direct ? staged & ~(block_size - 1) : staged;
+        if (bytes > 0 && !flush(bytes))
+        {
+            closeSegment();
+            return;
+        }
+        if (!direct && config.wav && written >= wav_header_size)
+        {
+            // a crash leaves a header that covers what is on disk
+            patchHeader(written - wav_header_size);
+        }
+        fdatasync(fd);
+        last_sync = now();
+    }
+
+    void closeSegment()
+    {
+        if (fd < 0)
+        {
+            return;
+        }
+
+        /* the tail is shorter than a block, which O_DIRECT cannot write */
+        if (direct)
+        {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+            direct = false;
+        }
+        if (staged > 0)
+        {
+            flush(staged);
+        }
+
+        // after a failed write only what made it to disk counts
+        uint64_t header_bytes = config.wav ? wav_header_size : 0;
+        segment.bytes = written > header_bytes ? written - header_bytes : 0;
+        segment.frames = segment.bytes / frame_bytes;
+        if (config.wav && written >= header_bytes)
+        {
+            patchHeader(segment.bytes);
+        }
+        fdatasync(fd);
+        ::close(fd);
+        fd = -1;
+
+        segment.dropped = dropped.exchange(0, std::memory_order_relaxed);
+        on_segment(segment);
+    }
+
+    void patchHeader(uint64_t data_bytes)
+    {
+        char buffer[wav_header_size];
+        header(buffer, segment.rate, static_cast<uint32_t>(data_bytes));
+        if (pwrite(fd, buffer, wav_header_size, 0) != static_cast<ssize_t>(wav_header_size))
+        {
+            on_error("Unable to write the header of " + segment.path + ": " + strerror(errno));
+        }
+    }
+
+    /* the canonical 44 byte RIFF/WAVE header: PCM, or IEEE float for the float formats */
+    void header(char *out, unsigned int rate, uint32_t data_bytes) const
+    {
+        uint16_t tag = snd_pcm_format_float(format) == 1 ? 3 : 1;
+        uint16_t bits = static_cast<uint16_t>(snd_pcm_format_physical_width(format));
+        uint16_t block_align = static_cast<uint16_t>(frame_bytes);
+
+        memcpy(out, "RIFF", 4);
+        put32(out + 4, 36 + data_bytes);
+        memcpy(out + 8, "WAVEfmt ", 8);
+        put32(out + 16, 16);
+        put16(out + 20, tag);
+        put16(out + 22, static_cast<uint16_t>(channels));
+        put32(out + 24, rate);
+        put32(out + 28, rate * block_align);
+        put16(out + 32, block_align);
+        put16(out + 34, bits);
+        memcpy(out + 36, "data", 4);
+        put32(out + 40, data_bytes);
+    }
+
+    static void put16(char *p, uint16_t value)
+    {
+        p[0] = static_cast<char>(value & 0xff);
+        p[1] = static_cast<char>(value >> 8);
+    }
+
+    static void put32(char *p, uint32_t value)
+    {
+        for (int b = 0; b < 4; b++)
+        {
+            p[b] = static_cast<char>((value >> (8 * b)) & 0xff);
+        }
+    }
+
+    static int64_t now()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+    }
+
+    RecordConfig config;
+    int device;
+    snd_pcm_format_t format;
+    size_t channels;
+    size_t frame_bytes;
+    SegmentCallback on_segment;
+    ErrorCallback on_error;
+
+    SpscRing<Entry> entries;
+    int wake_fd;
+    std::atomic<bool> stopping;
+    // frames push() could not hand over, since the last segment closed
+    std::atomic<uint64_t> dropped;
+    std::thread writer;
+
+    // writer thread only: the open segment, -1 if none
+    int fd;
+    bool direct;
+    RecordSegment segment;
+    char *staging;
+    size_t staged;
+    // bytes of the segment on disk, header included
+    uint64_t written;
+    unsigned int index;
+    bool open_failed;
+    int64_t last_sync;
+};
+
+#endif // ____Recorder__
@@ -0,0 +1,386 @@
+#ifndef ____Resampler__
+#define ____Resampler__
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "deinterleave.h"
+#include "sample-convert.h"
+
+enum ResampleQuality
+{
+    RESAMPLE_FAST = 0,
+    RESAMPLE_MEDIUM = 1,
+    RESAMPLE_BEST = 2
+};
+
+typedef float (*DotKernel)(const float *x, const float *h, size_t taps);
+
+namespace resample
+{
+    /* taps per output sample (before widening for downsampling), Kaiser beta and passband edge of a preset */
+    struct Preset
+    {
+        size_t taps;
+        double beta;
+        double cutoff;
+    };
+
+    inline Preset preset(ResampleQuality quality)
+    {
+        switch (quality)
+        {
+        case RESAMPLE_FAST:
+            return {16, 6.0, 0.90};
+        case RESAMPLE_BEST:
+            return {64, 10.0, 0.97};
+        default:
+            return {32, 8.0, 0.94};
+        }
+    }
+
+    inline bool quality_from_name(const std::string &name, ResampleQuality &quality)
+    {
+        if (name == "fast")
+        {
+            quality = RESAMPLE_FAST;
+        }
+        else if (name == "medium")
+        {
+            quality = RESAMPLE_MEDIUM;
+        }
+        else if (name == "best")
+        {
+            quality = RESAMPLE_BEST;
+        }
+        else
+        {
+            return false;
+        }
+        return true;
+    }
+
+    /* zeroth order modified Bessel function of the first kind, for the Kaiser window */
+    inline double bessel_i0(double x)
+    {
+        double sum = 1.0;
+        double term = 1.0;
+        for (int k = 1; k < 50; k++)
+        {
+            double factor = x / (2.0 * k);
+            term *= factor * factor;
+            sum += term;
+            if (term < sum * 1e-12)
+            {
+                break;
+            }
+        }
+        return sum;
+    }
+
+    inline float dot_scalar(const float *x, const float *h, size_t taps)
+    {
+        float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        for (size_t i = 0; i < taps; i += 4)
+        {
+            sum[0] += x[i] * h[i];
+            sum[1] += x[i + 1] * h[i + 1];
+            sum[2] += x[i + 2] * h[i + 2];
+            sum[3] += x[i + 3] * h[i + 3];
+        }
+        return (sum[0] + sum[1]) + (sum[2] + sum[3]);
+    }
+
+#ifdef SAMPLE_CONVERT_X86
+    __attribute__((target("sse2"))) inline float dot_sse2(const float *x, const float *h, size_t taps)
+    {
+        __m128 a = _mm_setzero_ps();
+        __m128 b = _mm_setzero_ps();
+        for (size_t i = 0; i < taps; i += 8)
+        {
+            a = _mm_add_ps(a, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(h + i)));
+            b = _mm_add_ps(b, _mm_mul_ps(_mm_loadu_ps(x + i + 4), _mm_loadu_ps(h + i + 4)));
+        }
+        a = _mm_add_ps(a, b);
+        a = _mm_add_ps(a, _mm_movehl_ps(a, a));
+        a = _mm_add_ss(a, _mm_shuffle_ps(a, a, 1));
+        return _mm_cvtss_f32(a);
+    }
+
+    __attribute__((target("avx2,fma"))) inline float dot_avx2(const float *x, const float *h, size_t taps)
+    {
+        __m256 a = _mm256_setzero_ps();
+        __m256 b = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i + 16 <= taps; i += 16)
+        {
+            a = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(h + i), a);
+            b = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 8), _mm256_loadu_ps(h + i + 8), b);
+        }
+        if (i < taps)
+        {
+            a = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(h + i), a);
+        }
+        a = _mm256_add_ps(a, b);
+        __m128 s = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+        s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+        s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+        return _mm_cvtss_f32(s);
+    }
+
+    inline bool has_avx2_fma()
+    {
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    }
+#endif
+
+#ifdef SAMPLE_CONVERT_NEON
+    inline float dot_neon(const float *x, const float *h, size_t taps)
+    {
+        float32x4_t a = vdupq_n_f32(0.0f);
+        float32x4_t b = vdupq_n_f32(0.0f);
+        for (size_t i = 0; i < taps; i += 8)
+        {
+            a = vmlaq_f32(a, vld1q_f32(x + i), vld1q_f32(h + i));
+            b = vmlaq_f32(b, vld1q_f32(x + i + 4), vld1q_f32(h + i + 4));
+        }
+        a = vaddq_f32(a, b);
+        float32x2_t s = vadd_f32(vget_low_f32(a), vget_high_f32(a));
+        return vget_lane_f32(vpadd_f32(s, s), 0);
+    }
+#endif
+} // namespace resample
+
+/*
+ * Polyphase windowed-sinc (Kaiser) resampling of interleaved Float32 frames
+ * for resample/outputRate. With in_rate / out_rate reduced to down / up,
+ * output frame n sits at input frame n * down / up; its fraction selects one
+ * of up filter phases. Ratios of more than max_phases phases (odd rates a
+ * card grants) interpolate between the two nearest of max_phases phases.
+ *
+ * Every channel keeps its own line of recent input so the filter runs over
+ * contiguous samples; the dot product is the SIMD kernel. The first output
+ * frame is aligned with the first input frame, and an output frame is
+ * written once half the filter length of input after it has arrived.
+ */
+class Resampler
+{
+public:
+    static const uint64_t max_phases = 1024;
+    static const size_t max_taps = 1024;
+
+    Resampler()
+        : channels(0), taps(0), half(0), up(1), down(1), step_int(0), step_frac(0), interpolate(false), row_scale(0), stride(0),
+          filled(0), pos(0), num(0), kernel(resample::dot_scalar), kernel_name("none") {}
+
+    /* max_frames is the most frames a single process() call passes in */
+    Resampler(size_t channels, unsigned int in_rate, unsigned int out_rate, ResampleQuality quality, size_t max_frames)
+        : channels(channels), interpolate(false), filled(0), pos(0), num(0), kernel(resample::dot_scalar), kernel_name("scalar")
+    {
+        uint64_t g = gcd(in_rate, out_rate);
+        up = out_rate / g;
+        down = in_rate / g;
+        step_int = down / up;
+        step_frac = down % up;
+
+        /* downsampling lowers the cutoff, so the filter gets as many more taps to keep its steepness */
+        resample::Preset preset = resample::preset(quality);
+        double scale = std::min(1.0, static_cast<double>(out_rate) / in_rate);
+        size_t widen = static_cast<size_t>(std::ceil(1.0 / scale));
+        taps = std::min(max_taps, (preset.taps * widen + 7) & ~static_cast<size_t>(7));
+        half = taps / 2;
+
+        uint64_t phases = up;
+        if (up > max_phases)
+        {
+            phases = max_phases;
+            interpolate = true;
+            blended.resize(taps);
+        }
+        design(phases, preset.cutoff * scale, preset.beta);
+
+        stride = taps + max_frames;
+        line.assign(channels * stride, 0.0f);
+        // zeros before the first frame, so the first output is centered on it
+        filled = half - 1;
+
+        select();
+    }
+
+    bool active() const
+    {
+        return channels > 0;
+    }
+
+    /* most output frames process() writes for frames input frames */
+    size_t maxOutput(size_t frames) const
+    {
+        return static_cast<size_t>((frames * up + down - 1) / down) + 1;
+    }
+
+    /* input frames an output frame lags behind the newest input */
+    size_t delay() const
+    {
+        return half;
+    }
+
+    const char *kernelName() const
+    {
+        return kernel_name;
+    }
+
+    /* resamples frames interleaved frames from in to out (room for maxOutput(frames)); returns the frames written */
+    size_t process(const float *in, size_t frames, float *out)
+    {
+        deinterleave_frames(reinterpret_cast<const char *>(in), reinterpret_cast<char *>(&line[filled]), frames, channels,
+                            sizeof(float), stride * sizeof(float));
+        filled += frames;
+
+        size_t n = 0;
+        while (pos + taps <= filled)
+        {
+            const float *h = row();
+            for (size_t c = 0; c < channels; c++)
+            {
+                out[n * channels + c] = kernel(&line[c * stride + pos], h, taps);
+            }
+            n++;
+
+            pos += step_int;
+            num += step_frac;
+            if (num >= up)
+            {
+                num -= up;
+                pos++;
+            }
+        }
+
+        /* only the samples the next outputs still need stay in the lines */
+        if (pos < filled)
+        {
+            for (size_t c = 0; c < channels; c++)
+            {
+                float *plane = &line[c * stride];
+                memmove(plane, plane + pos, (filled - pos) * sizeof(float));
+            }
+            filled -= pos;
+            pos = 0;
+        }
+        else
+        {
+            pos -= filled;
+            filled = 0;
+        }
+        return n;
+    }
+
+private:
+    static uint64_t gcd(uint64_t a, uint64_t b)
+    {
+        while (b != 0)
+        {
+            uint64_t t = a % b;
+            a = b;
+            b = t;
+        }
+        return a;
+    }
+
+    /* one row of taps per phase (plus the closing one when interpolating), each summing to 1 */
+    void design(uint64_t phases, double cutoff, double beta)
+    {
+        size_t rows = static_cast<size_t>(interpolate ? phases + 1 : phases);
+        coefs.assign(rows * taps, 0.0f);
+        row_scale = static_cast<double>(phases) / up;
+
+        double norm = resample::bessel_i0(beta);
+        std::vector<double> h(taps);
+        for (size_t p = 0; p < rows; p++)
+        {
+            double frac = static_cast<double>(p) / phases;
+            double sum = 0.0;
+            for (size_t k = 0; k < taps; k++)
+            {
+                double t = static_cast<double>(k) - (half - 1) - frac;
+                double x = cutoff * t;
+                double sinc = x == 0.0 ? 1.0 : std::sin(M_PI * x) / (M_PI * x);
+                double r = t / half;
+                double window = r * r < 1.0 ? resample::bessel_i0(beta * std::sqrt(1.0 - r * r)) / norm : 0.0;
+                h[k] = sinc * window;
+                sum += h[k];
+            }
+            for (size_t k = 0; k < taps; k++)
+            {
+                coefs[p * taps + k] = static_cast<float>(h[k] / sum);
+            }
+        }
+    }
+
+    const float *row()
+    {
+        if (!interpolate)
+        {
+            return &coefs[num * taps];
+        }
+
+        double position = num * row_scale;
+        size_t r = static_cast<size_t>(position);
+        float b = static_cast<float>(position - r);
+        const float *h0 = &coefs[r * taps];
+        const float *h1 = h0 + taps;
+        for (size_t k = 0; k < taps; k++)
+        {
+            blended[k] = h0[k] + b * (h1[k] - h0[k]);
+        }
+        return blended.data();
+    }
+
+    void select()
+    {
+#ifdef SAMPLE_CONVERT_X86
+        if (resample::has_avx2_fma())
+        {
+            kernel = resample::dot_avx2;
+            kernel_name = "avx2";
+        }
+        else if (sample_convert::has_sse2())
+        {
+            kernel = resample::dot_sse2;
+            kernel_name = "sse2";
+        }
+#endif
+#ifdef SAMPLE_CONVERT_NEON
+        kernel = resample::dot_neon;
+        kernel_name = "neon";
+#endif
+    }
+
+    size_t channels;
+    // taps of every phase, a multiple of 8
+    size_t taps;
+    size_t half;
+    // out_rate / in_rate reduced; the position advances by down / up input frames per output frame
+    uint64_t up;
+    uint64_t down;
+    uint64_t step_int;
+    uint64_t step_frac;
+    bool interpolate;
+    double row_scale;
+    std::vector<float> coefs;
+    std::vector<float> blended;
+    // input lines, one per channel stride floats apart, filled samples each; pos + num / up is where the next output starts
+    std::vector<float> line;
+    size_t stride;
+    size_t filled;
+    size_t pos;
+    uint64_t num;
+    DotKernel kernel;
+    const char *kernel_name;
+};
+
+#endif // ____Resampler__
@@ -0,0 +1,646 @@
+#ifndef ____SampleConvert__
+#define ____SampleConvert__
+
+#include <stdint.h>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+#define ALSA_PCM_NEW_HW_PARAMS_API
+
+#include <alsa/asoundlib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SAMPLE_CONVERT_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define SAMPLE_CONVERT_NEON 1
+#include <arm_neon.h>
+#endif
+
+/*
+ * Conversion of captured samples to Float32 or S16 on the capture thread.
+ *
+ * Every format goes through the scalar path, which defines the exact result:
+ * a sample is left aligned into an int32 and then scaled by 2^-31 (f32) or
+ * shifted right by 16 (s16); float input is scaled by 32768, rounded to
+ * nearest even and saturated for s16. The SIMD kernels for the common
+ * formats (S16_LE, S24_LE, S32_LE, S24_3LE, FLOAT_LE) produce bit identical
+ * output and are picked at runtime from the CPU features.
+ */
+enum SampleOutput
+{
+    SAMPLE_OUTPUT_RAW = 0,
+    SAMPLE_OUTPUT_F32 = 1,
+    SAMPLE_OUTPUT_S16 = 2
+};
+
+typedef void (*ConvertKernel)(const char *src, char *dst, size_t samples);
+
+namespace sample_convert
+{
+    const float int32_scale = 1.0f / 2147483648.0f;
+    const float int16_scale = 1.0f / 32768.0f;
+
+    /* layout of an ALSA linear/float format */
+    struct FormatInfo
+    {
+        int physical_bytes;
+        int width;
+        bool is_signed;
+        bool little_endian;
+        bool is_float;
+    };
+
+    inline FormatInfo format_info(snd_pcm_format_t format)
+    {
+        FormatInfo info;
+        info.physical_bytes = snd_pcm_format_physical_width(format) / 8;
+        info.width = snd_pcm_format_width(format);
+        info.is_signed = snd_pcm_format_signed(format) == 1;
+        info.little_endian = snd_pcm_format_little_endian(format) == 1;
+        info.is_float = snd_pcm_format_float(format) == 1;
+        return info;
+    }
+
+    inline uint64_t load_bytes(const unsigned char *p, int bytes, bool little_endian)
+    {
+        uint64_t value = 0;
+        for (int b = 0; b < bytes; b++)
+        {
+            int shift = little_endian ? b : bytes - 1 - b;
+            value |= static_cast<uint64_t>(p[b]) << (8 * shift);
+        }
+        return value;
+    }
+
+    /* integer sample, sign handled, left aligned into the top bits of an int32 */
+    inline int32_t left_aligned(const unsigned char *p, const FormatInfo &info)
+    {
+        uint32_t value = static_cast<uint32_t>(load_bytes(p, info.physical_bytes, info.little_endian));
+        value <<= 32 - info.width;
+        if (!info.is_signed)
+        {
+            value ^= 0x80000000u;
+        }
+        return static_cast<int32_t>(value);
+    }
+
+    inline float load_float(const unsigned char *p, const FormatInfo &info)
+    {
+        uint64_t bits = load_bytes(p, info.physical_bytes, info.little_endian);
+        if (info.physical_bytes == 8)
+        {
+            double value;
+            memcpy(&value, &bits, sizeof(value));
+            return static_cast<float>(value);
+        }
+
+        uint32_t bits32 = static_cast<uint32_t>(bits);
+        float value;
+        memcpy(&value, &bits32, sizeof(value));
+        return value;
+    }
+
+    inline int16_t float_to_s16(float value)
+    {
+        float scaled = std::nearbyint(value * 32768.0f);
+        if (!(scaled > -32768.0f))
+        {
+            return -32768;
+        }
+        if (scaled > 32767.0f)
+        {
+            return 32767;
+        }
+        return static_cast<int16_t>(scaled);
+    }
+
+    /* scalar reference path for every format */
+    inline void scalar_to_f32(const char *src, char *dst, size_t samples, const FormatInfo &info)
+    {
+        const unsigned char *in = reinterpret_cast<const unsigned char *>(src);
+        float *out = reinterpret_cast<float *>(dst);
+
+        for (size_t i = 0; i < samples; i++, in += info.physical_bytes)
+        {
+            out[i] = info.is_float ? load_float(in, info)
+                                   : static_cast<float>(left_aligned(in, info)) * int32_scale;
+        }
+    }
+
+    inline void scalar_to_s16(const char *src, char *dst, size_t samples, const FormatInfo &info)
+    {
+        const unsigned char *in = reinterpret_cast<const unsigned char *>(src);
+        int16_t *out = reinterpret_cast<int16_t *>(dst);
+
+        for (size_t i = 0; i < samples; i++, in += info.physical_bytes)
+        {
+            out[i] = info.is_float ? float_to_s16(load_float(in, info))
+                                   : static_cast<int16_t>(left_aligned(in, info) >> 16);
+        }
+    }
+
+    /* scalar tails of the SIMD kernels, same arithmetic as the reference path */
+    inline void s16_to_f32_tail(const int16_t *in, float *out, size_t n)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            out[i] = static_cast<float>(in[i]) * int16_scale;
+        }
+    }
+
+    inline void s32_to_f32_tail(const int32_t *in, float *out, size_t n, int shift)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            out[i] = static_cast<float>(static_cast<int32_t>(static_cast<uint32_t>(in[i]) << shift)) * int32_scale;
+        }
+    }
+
+    inline int32_t load_s24_3le(const unsigned char *p)
+    {
+        return static_cast<int32_t>((static_cast<uint32_t>(p[0]) << 8) |
+                                    (static_cast<uint32_t>(p[1]) << 16) |
+                                    (static_cast<uint32_t>(p[2]) << 24));
+    }
+
+    inline void s24_3le_to_f32_tail(const unsigned char *in, float *out, size_t n)
+    {
+        for (size_t i = 0; i < n; i++, in += 3)
+        {
+            out[i] = static_cast<float>(load_s24_3le(in)) * int32_scale;
+        }
+    }
+
+    inline void s32_to_s16_tail(const int32_t *in, int16_t *out, size_t n, int shift)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            out[i] = static_cast<int16_t>(static_cast<int32_t>(static_cast<uint32_t>(in[i]) << shift) >> 16);
+        }
+    }
+
+    inline void s24_3le_to_s16_tail(const unsigned char *in, int16_t *out, size_t n)
+    {
+        for (size_t i = 0; i < n; i++, in += 3)
+        {
+            out[i] = static_cast<int16_t>(load_s24_3le(in) >> 16);
+        }
+    }
+
+    inline void f32_to_s16_tail(const float *in, int16_t *out, size_t n)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            out[i] = float_to_s16(in[i]);
+        }
+    }
+
+    /* plain copies (S16_LE to s16, FLOAT_LE to f32) */
+    inline void copy2(const char *src, char *dst, size_t samples)
+    {
+        memcpy(dst, src, samples * 2);
+    }
+
+    inline void copy4(const char *src, char *dst, size_t samples)
+    {
+        memcpy(dst, src, samples * 4);
+    }
+
+    inline void scalar_s16le_f32(const char *src, char *dst, size_t samples)
+    {
+        s16_to_f32_tail(reinterpret_cast<const int16_t *>(src), reinterpret_cast<float *>(dst), samples);
+    }
+
+    inline void scalar_s32le_f32(const char *src, char *dst, size_t samples)
+    {
+        s32_to_f32_tail(reinterpret_cast<const int32_t *>(src), reinterpret_cast<float *>(dst), samples, 0);
+    }
+
+    inline void scalar_s24le_f32(const char *src, char *dst, size_t samples)
+    {
+        s32_to_f32_tail(reinterpret_cast<const int32_t *>(src), reinterpret_cast<float *>(dst), samples, 8);
+    }
+
+    inline void scalar_s24_3le_f32(const char *src, char *dst, size_t samples)
+    {
+        s24_3le_to_f32_tail(reinterpret_cast<const unsigned char *>(src), reinterpret_cast<float *>(dst), samples);
+    }
+
+    inline void scalar_s32le_s16(const char *src, char *dst, size_t samples)
+    {
+        s32_to_s16_tail(reinterpret_cast<const int32_t *>(src), reinterpret_cast<int16_t *>(dst), samples, 0);
+    }
+
+    inline void scalar_s24le_s16(const char *src, char *dst, size_t samples)
+    {
+        s32_to_s16_tail(reinterpret_cast<const int32_t *>(src), reinterpret_cast<int16_t *>(dst), samples, 8);
+    }
+
+    inline void scalar_s24_3le_s16(const char *src, char *dst, size_t samples)
+    {
+        s24_3le_to_s16_tail(reinterpret_cast<const unsigned char *>(src), reinterpret_cast<int16_t *>(dst), samples);
+    }
+
+    inline void scalar_f32le_s16(const char *src, char *dst, size_t samples)
+    {
+        f32_to_s16_tail(reinterpret_cast<const float *>(src), reinterpret_cast<int16_t *>(dst), samples);
+    }
+
+#ifdef SAMPLE_CONVERT_X86
+    __attribute__((target("sse2"))) inline void sse2_s16le_f32(const char *src, char *dst, size_t samples)
+    {
+        const int16_t *in = reinterpret_cast<const int16_t *>(src);
+        float *out = reinterpret_cast<float *>(dst);
+        const __m128 scale = _mm_set1_ps(int16_scale);
+        size_t i = 0;
+
+        for (; i + 8 <= samples; i += 8)
+        {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+            __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+            __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+            _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+            _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+        }
+        s16_to_f32_tail(in + i, out + i, samples - i);
+    }
+
+    template <int shift>
+    __attribute__((target("sse2"))) inline void sse2_s32le_f32(const char *src, char *dst, size_t samples)
+    {
+        const int32_t *in = reinterpret_cast<const int32_t *>(src);
+        float *out = reinterpret_cast<float *>(dst);
+        const __m128 scale = _mm_set1_ps(int32_scale);
+        size_t i = 0;
+
+        for (; i + 4 <= samples; i += 4)
+        {
+            __m128i x = _mm_slli_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i)), shift);
+            _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(x), scale));
+        }
+        s32_to_f32_tail(in + i, out + i, samples - i, shift);
+    }
+
+    template <int shift>
+    __attribute__((target("sse2"))) inline void sse2_s32le_s16(const char *src, char *dst, size_t samples)
+    {
+        const int32_t *in = reinterpret_cast<const int32_t *>(src);
+        int16_t *out = reinterpret_cast<int16_t *>(dst);
+        size_t i = 0;
+
+        for (; i + 8 <= samples; i += 8)
+        {
+            __m128i a = _mm_srai_epi32(_mm_slli_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i)), shift), 16);
+            __m128i b = _mm_srai_epi32(_mm_slli_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i + 4)), shift), 16);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_packs_epi32(a, b));
+        }
+        s32_to_s16_tail(in + i, out + i, samples - i, shift);
+    }
+
+    __attribute__((target("sse2"))) inline void sse2_f32le_s16(const char *src, char *dst, size_t samples)
+    {
+        const float *in = reinterpret_cast<const float *>(src);
+        int16_t *out = reinterpret_cast<int16_t *>(dst);
+        const __m128 scale = _mm_set1_ps(32768.0f);
+        const __m128 low = _mm_set1_ps(-32768.0f);
+        const __m128 high = _mm_set1_ps(32767.0f);
+        size_t i = 0;
+
+        for (; i + 8 <= samples; i += 8)
+        {
+            // clamp before converting so out of range values and NaN saturate like the scalar path
+            __m128 a = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + i), scale), low), high);
+            __m128 b = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + i + 4), scale), low), high);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b)));
+        }
+        f32_to_s16_tail(in + i, out + i, samples - i);
+    }
+
+    __attribute__((target("avx2"))) inline void avx2_s16le_f32(const char *src, char *dst, size_t samples)
+    {
+        const int16_t *in = reinterpret_cast<const int16_t *>(src);
+        float *out = reinterpret_cast<float *>(dst);
+        const __m256 scale = _mm256_set1_ps(int16_scale);
+        size_t i = 0;
+
+        for (; i + 8 <= samples; i += 8)
+        {
+            __m256i x = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i)));
+            _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(x), scale));
+        }
+        s16_to_f32_tail(in + i, out + i, samples - i);
+    }
+
+    template <int shift>
+    __attribute__((target("avx2"))) inline void avx2_s32le_f32(const char *src, char *dst, size_t samples)
+    {
+        const int32_t *in = reinterpret_cast<const int32_t *>(src);
+        float *out = reinterpret_cast<float *>(dst);
+        const __m256 scale = _mm256_set1_ps(int32_scale);
+        size_t i = 0;
+
+        for (; i + 8 <= samples; i += 8)
+        {
+            __m256i x = _mm256_slli_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i)), shift);
+            _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(x), scale));
+        }
+        s32_to_f32_tail(in + i, out + i, samples - i, shift);
+    }
+
+    /* 4 packed 24 bit samples per 128 bit lane, moved into the top 3 bytes of each int32 */
+    __attribute__((target("avx2"))) inline __m256i avx2_load_s24_3le(const unsigned char *in)
+    {
+        const __m256i shuffle = _mm256_setr_epi8(
+            -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+            -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+        __m256i x = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in))),
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 12)), 1);
+        return _mm256_shuffle_epi8(x, shuffle);
+    }
+
+    __attribute__((target("avx2"))) inline void avx2_s24_3le_f32(const char *src, char *dst, size_t samples)
+    {
+        const unsigned char *in = reinterpret_cast<const unsigned char *>(src);
+        float *out = reinterpret_cast<float *>(dst);
+        const __m256 scale = _mm256_set1_ps(int32_scale);
+        size_t i = 0;
+
+        // the second 16 byte load reads 4 bytes past the 8 samples, keep that inside the input
+        for (; i + 10 <= samples; i += 8)
+        {
+            __m256i x = avx2_load_s24_3le(in + i * 3);
+            _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(x), scale));
+        }
+        s24_3le_to_f32_tail(in + i * 3, out + i, samples - i);
+    }
+
+    __attribute__((target("avx2"))) inline void avx2_s24_3le_s16(const char *src, char *dst, size_t samples)
+    {
+        const unsigned char *in = reinterpret_cast<const unsigned char *>(src);
+        int16_t *out = reinterpret_cast<int16_t *>(dst);
+        size_t i = 0;
+
+        for (; i + 10 <= samples; i += 8)
+        {
+            __m256i x = _mm256_srai_epi32(avx2_load_s24_3le(in + i * 3), 16);
+            __m128i packed = _mm_packs_epi32(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), packed);
+        }
+        s24_3le_to_s16_tail(in + i * 3, out + i, samples - i);
+    }
+#endif
+
+#ifdef SAMPLE_CONVERT_NEON
+    inline void neon_s16le_f32(const char *src, char *dst, size_t samples)
+    {
+        const int16_t *in = reinterpret_cast<const int16_t *>(src);
+        float *out = reinterpret_cast<float *>(dst);
+        size_t i = 0;
+
+        for (; i + 8 <= samples; i += 8)
+        {
+            int16x8_t x = vld1q_s16(in + i);
+            vst1q_f32(out + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))), int16_scale));
+            vst1q_f32(out + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x))), int16_scale));
+        }
+        s16_to_f32_tail(in + i, out + i, samples - i);
+    }
+
+    template <int shift>
+    inline void neon_s32le_f32(const char *src, char *dst, size_t samples)
+    {
+        const int32_t *in = reinterpret_cast<const int32_t *>(src);
+        float *out = reinterpret_cast<float *>(dst);
+        size_t i = 0;
+
+        for (; i + 4 <= samples; i += 4)
+        {
+            int32x4_t x = vshlq_n_s32(vld1q_s32(in + i), shift);
+            vst1q_f32(out + i, vmulq_n_f32(vcvtq_f32_s32(x), int32_scale));
+        }
+        s32_to_f32_tail(in + i, out + i, samples - i, shift);
+    }
+
+    template <int shift>
+    inline void neon_s32le_s16(const char *src, char *dst, size_t samples)
+    {
+        const int32_t *in = reinterpret_cast<const int32_t *>(src);
+        int16_t *out = reinterpret_cast<int16_t *>(dst);
+        size_t i = 0;
+
+        for (; i + 4 <= samples; i += 4)
+        {
+            int32x4_t x = vshlq_n_s32(vld1q_s32(in + i), shift);
+            vst1_s16(out + i, vshrn_n_s32(x, 16));
+        }
+        s32_to_s16_tail(in + i, out + i, samples - i, shift);
+    }
+#endif
+
+    inline bool has_avx2()
+    {
+#ifdef SAMPLE_CONVERT_X86
+        return __builtin_cpu_supports("avx2");
+#else
+        return false;
+#endif
+    }
+
+    inline bool has_sse2()
+    {
+#ifdef SAMPLE_CONVERT_X86
+        return __builtin_cpu_supports("sse2");
+#else
+        return false;
+#endif
+    }
+} // namespace sample_convert
+
+class SampleConverter
+{
+public:
+    SampleConverter()
+        : output(SAMPLE_OUTPUT_RAW), kernel(NULL), kernel_name("none")
+    {
+        info = {0, 0, false, false, false};
+    }
+
+    SampleConverter(snd_pcm_format_t format, SampleOutput output)
+        : output(output), kernel(NULL), kernel_name("scalar")
+    {
+        info = sample_convert::format_info(format);
+        if (output != SAMPLE_OUTPUT_RAW)
+        {
+            select(format);
+        }
+    }
+
+    /* converts samples (frames * channels) from src to dst; dst must hold samples * outputBytes() */
+    void convert(const char *src, char *dst, size_t samples) const
+    {
+        if (kernel)
+        {
+            kernel(src, dst, samples);
+        }
+        else if (output == SAMPLE_OUTPUT_F32)
+        {
+            sample_convert::scalar_to_f32(src, dst, samples, info);
+        }
+        else if (output == SAMPLE_OUTPUT_S16)
+        {
+            sample_convert::scalar_to_s16(src, dst, samples, info);
+        }
+        else
+        {
+            memcpy(dst, src, samples * info.physical_bytes);
+        }
+    }
+
+    bool active() const
+    {
+        return output != SAMPLE_OUTPUT_RAW;
+    }
+
+    /* bytes per sample after conversion */
+    size_t outputBytes() const
+    {
+        switch (output)
+        {
+        case SAMPLE_OUTPUT_F32:
+            return 4;
+        case SAMPLE_OUTPUT_S16:
+            return 2;
+        default:
+            return info.physical_bytes;
+        }
+    }
+
+    SampleOutput outputType() const
+    {
+        return output;
+    }
+
+    const char *kernelName() const
+    {
+        return kernel_name;
+    }
+
+private:
+    void use(ConvertKernel k, const char *name)
+    {
+        kernel = k;
+        kernel_name = name;
+    }
+
+    void select(snd_pcm_format_t format)
+    {
+        using namespace sample_convert;
+
+        bool avx2 = has_avx2();
+        bool sse2 = has_sse2();
+        (void)avx2;
+        (void)sse2;
+
+        if (output == SAMPLE_OUTPUT_F32)
+        {
+            switch (format)
+            {
+            case SND_PCM_FORMAT_FLOAT_LE:
+                use(copy4, "copy");
+                return;
+            case SND_PCM_FORMAT_S16_LE:
+#ifdef SAMPLE_CONVERT_X86
+                if (avx2)
+                    return use(avx2_s16le_f32, "avx2");
+                if (sse2)
+                    return use(sse2_s16le_f32, "sse2");
+#endif
+#ifdef SAMPLE_CONVERT_NEON
+                return use(neon_s16le_f32, "neon");
+#endif
+                return use(scalar_s16le_f32, "scalar");
+            case SND_PCM_FORMAT_S32_LE:
+#ifdef SAMPLE_CONVERT_X86
+                if (avx2)
+                    return use(avx2_s32le_f32<0>, "avx2");
+                if (sse2)
+                    return use(sse2_s32le_f32<0>, "sse2");
+#endif
+#ifdef SAMPLE_CONVERT_NEON
+                return use(neon_s32le_f32<0>, "neon");
+#endif
+                return use(scalar_s32le_f32, "scalar");
+            case SND_PCM_FORMAT_S24_LE:
+#ifdef SAMPLE_CONVERT_X86
+                if (avx2)
+                    return use(avx2_s32le_f32<8>, "avx2");
+                if (sse2)
+                    return use(sse2_s32le_f32<8>, "sse2");
+#endif
+#ifdef SAMPLE_CONVERT_NEON
+                return use(neon_s32le_f32<8>, "neon");
+#endif
+                return use(scalar_s24le_f32, "scalar");
+            case SND_PCM_FORMAT_S24_3LE:
+#ifdef SAMPLE_CONVERT_X86
+                if (avx2)
+                    return use(avx2_s24_3le_f32, "avx2");
+#endif
+                return use(scalar_s24_3le_f32, "scalar");
+            default:
+                return;
+            }
+        }
+
+        switch (format)
+        {
+        case SND_PCM_FORMAT_S16_LE:
+            use(copy2, "copy");
+            return;
+        case SND_PCM_FORMAT_S32_LE:
+#ifdef SAMPLE_CONVERT_X86
+            if (sse2)
+                return use(sse2_s32le_s16<0>, "sse2");
+#endif
+#ifdef SAMPLE_CONVERT_NEON
+            return use(neon_s32le_s16<0>, "neon");
+#endif
+            return use(scalar_s32le_s16, "scalar");
+        case SND_PCM_FORMAT_S24_LE:
+#ifdef SAMPLE_CONVERT_X86
+            if (sse2)
+                return use(sse2_s32le_s16<8>, "sse2");
+#endif
+#ifdef SAMPLE_CONVERT_NEON
+            return use(neon_s32le_s16<8>, "neon");
+#endif
+            return use(scalar_s24le_s16, "scalar");
+        case SND_PCM_FORMAT_S24_3LE:
+#ifdef SAMPLE_CONVERT_X86
+            if (avx2)
+                return use(avx2_s24_3le_s16, "avx2");
+#endif
+            return use(scalar_s24_3le_s16, "scalar");
+        case SND_PCM_FORMAT_FLOAT_LE:
+#ifdef SAMPLE_CONVERT_X86
+            if (sse2)
+                return use(sse2_f32le_s16, "sse2");
+#endif
+            return use(scalar_f32le_s16, "scalar");
+        default:
+            return;
+        }
+    }
+
+    SampleOutput output;
+    sample_convert::FormatInfo info;
+    ConvertKernel kernel;
+    const char *kernel_name;
+};
+
+#endif // ____SampleConvert__
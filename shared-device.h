@@ -0,0 +1,266 @@
+#ifndef ____SharedDevice__
+#define ____SharedDevice__
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "pcm-device.h"
+
+/* a capture attached to a device another capture reads; all calls come from the reading capture's thread */
+class DeviceSubscriber
+{
+public:
+    virtual ~DeviceSubscriber() {}
+
+    /*
+     * frames interleaved frames exactly as read from the device, with the
+     * timing the reader got for the last of them: when it was captured
+     * (monotonic ns) and the frames still waiting behind it
+     */
+    virtual void feed(const char *raw, size_t frames, int64_t captured, snd_pcm_sframes_t delay) = 0;
+
+    /* the reader stopped; this subscriber is to adopt() the device and read it on from its own thread */
+    virtual void takeOver() = 0;
+
+    /* the device went away for this subscriber; no feed() follows */
+    virtual void sourceLost(const std::string &reason) = 0;
+};
+
+/*
+ * A device opened by a single device capture (the owner) that further
+ * captures of the same device may attach to instead of opening it again.
+ * The owner publishes the parameters granted once the device is open and
+ * hands every period it reads to the subscribers. A reader that ends
+ * hands the open device over to the first subscriber left, which reads
+ * on from its own thread, so the device stays open until the last capture
+ * using it is gone. Subscribers are only called with the lock held, so
+ * after detach() returns none of them is called any more.
+ */
+class SharedDevice
+{
+public:
+    enum State
+    {
+        OPENING,
+        OPEN,
+        CLOSED
+    };
+
+    explicit SharedDevice(const PcmConfig &config)
+        : config(config), state(OPENING), actual_rate(0), frames(0), frame_bytes(0), count(0) {}
+
+    ~SharedDevice()
+    {
+        // handed over to a subscriber that ended before it adopted it
+        if (handed)
+        {
+            handed->close();
+        }
+    }
+
+    const std::string &name() const
+    {
+        return config.device;
+    }
+
+    /* the same samples: format, channels and rate as requested; buffer and period settings are the owner's */
+    bool compatible(const PcmConfig &other) const
+    {
+        return other.device == config.device && other.format == config.format && other.channels == config.channels &&
+               other.rate == config.rate;
+    }
+
+    /* owner: the device is open (again) with the parameters of pcm; subscribers set up for another rate are dropped */
+    void opened(const PcmDevice &pcm)
+    {
+        std::lock_guard<std::mutex> locker(mu);
+        if (state == OPEN && pcm.actual_rate != actual_rate)
+        {
+            detachAll("the device was reopened at another rate");
+        }
+        actual_rate = pcm.actual_rate;
+        frames = pcm.frames;
+        frame_bytes = pcm.frame_bytes;
+        state = OPEN;
+        ready.notify_all();
+    }
+
+    /* reader: checked on every period, so a device without subscribers is read as usual */
+    bool subscribed() const
+    {
+        return count.load(std::memory_order_relaxed) > 0;
+    }
+
+    /* reader: the raw frames just read */
+    void feed(const char *raw, size_t n, int64_t captured, snd_pcm_sframes_t delay)
+    {
+        std::lock_guard<std::mutex> locker(mu);
+        for (DeviceSubscriber *subscriber : subscribers)
+        {
+            subscriber->feed(raw, n, captured, delay);
+        }
+    }
+
+    /*
+     * reader: stops reading pcm. With subscribers left the open device is
+     * moved out of pcm for the first of them to adopt(); otherwise nothing
+     * can attach any more and false is returned, the caller closes pcm and
+     * then the device.
+     */
+    bool handOver(PcmDevice &pcm)
+    {
+        std::lock_guard<std::mutex> locker(mu);
+        if (subscribers.empty() || !pcm.handle)
+        {
+            state = CLOSED;
+            return false;
+        }
+
+        handed.reset(new PcmDevice(pcm));
+        pcm.handle = NULL;
+        subscribers.front()->takeOver();
+        return true;
+    }
+
+    /* subscriber told to takeOver(): the open device it reads from now on, NULL if it was not handed to it */
+    std::unique_ptr<PcmDevice> adopt()
+    {
+        std::lock_guard<std::mutex> locker(mu);
+        return std::move(handed);
+    }
+
+    /* the device is closed, lost or could not be opened; every subscriber is detached */
+    void close(const std::string &reason)
+    {
+        std::lock_guard<std::mutex> locker(mu);
+        detachAll(reason);
+        state = CLOSED;
+        ready.notify_all();
+    }
+
+    /* subscriber: waits up to timeout ms for the owner to open the device, then fills in the parameters granted */
+    State waitOpen(PcmDevice &pcm, int timeout)
+    {
+        std::unique_lock<std::mutex> locker(mu);
+        ready.wait_for(locker, std::chrono::milliseconds(timeout), [this]() { return state != OPENING; });
+        if (state == OPEN)
+        {
+            pcm.actual_rate = actual_rate;
+            pcm.frames = frames;
+            pcm.frame_bytes = frame_bytes;
+            pcm.period_bytes = frames * frame_bytes;
+        }
+        return state;
+    }
+
+    /* subscriber: false if the device closed or changed its rate since waitOpen() */
+    bool attach(DeviceSubscriber *subscriber, unsigned int rate)
+    {
+        std::lock_guard<std::mutex> locker(mu);
+        if (state != OPEN || rate != actual_rate)
+        {
+            return false;
+        }
+        subscribers.push_back(subscriber);
+        count.store(subscribers.size(), std::memory_order_relaxed);
+        return true;
+    }
+
+    void detach(DeviceSubscriber *subscriber)
+    {
+        std::lock_guard<std::mutex> locker(mu);
+        subscribers.erase(std::remove(subscribers.begin(), subscribers.end(), subscriber), subscribers.end());
+        count.store(subscribers.size(), std::memory_order_relaxed);
+    }
+
+private:
+    void detachAll(const std::string &reason)
+    {
+        for (DeviceSubscriber *subscriber : subscribers)
+        {
+            subscriber->sourceLost(reason);
+        }
+        subscribers.clear();
+        count.store(0, std::memory_order_relaxed);
+    }
+
+    PcmConfig config;
+    std::mutex mu;
+    std::condition_variable ready;
+    State state;
+    // granted by the device
+    unsigned int actual_rate;
+    snd_pcm_uframes_t frames;
+    size_t frame_bytes;
+    std::vector<DeviceSubscriber *> subscribers;
+    std::atomic<size_t> count;
+    // open, between handOver() and adopt()
+    std::unique_ptr<PcmDevice> handed;
+};
+
+namespace shared_device
+{
+    /* the devices single device captures of the process have open, by name */
+    class Registry
+    {
+    public:
+        /*
+         * The device a capture of config uses: a new one the caller opens
+         * itself (owner true), one another capture has (or is about to
+         * have) open to attach to, or NULL if another capture has it open
+         * with other parameters.
+         */
+        std::shared_ptr<SharedDevice> claim(const PcmConfig &config, bool &owner)
+        {
+            std::lock_guard<std::mutex> locker(mu);
+            auto entry = devices.find(config.device);
+            if (entry != devices.end())
+            {
+                owner = false;
+                return entry->second->compatible(config) ? entry->second : NULL;
+            }
+
+            owner = true;
+            std::shared_ptr<SharedDevice> device = std::make_shared<SharedDevice>(config);
+            devices[config.device] = device;
+            return device;
+        }
+
+        /* reader: once the device is closed, so a capture that claims it next can open it */
+        void remove(const std::shared_ptr<SharedDevice> &device)
+        {
+            std::lock_guard<std::mutex> locker(mu);
+            auto entry = devices.find(device->name());
+            if (entry != devices.end() && entry->second == device)
+            {
+                devices.erase(entry);
+            }
+        }
+
+    private:
+        std::mutex mu;
+        std::map<std::string, std::shared_ptr<SharedDevice>> devices;
+    };
+
+    /*
+     * Shared by all captures of the process, worker threads included: a
+     * device can be opened once per process, not once per environment. It
+     * holds no V8 state, and the captures of an environment that exits are
+     * joined by its cleanup hook, which detaches or closes their devices
+     * before the loop that their owners and subscribers signal goes away.
+     */
+    inline Registry &registry()
+    {
+        static Registry instance;
+        return instance;
+    }
+} // namespace shared_device
+
+#endif // ____SharedDevice__
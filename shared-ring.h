@@ -0,0 +1,147 @@
+#ifndef ____SharedRing__
+#define ____SharedRing__
+
+#include <stdint.h>
+#include <cstddef>
+#include <cstring>
+
+/*
+ * Byte ring in the memory of a SharedArrayBuffer for the sharedBuffer
+ * option. The first header_bytes are an Int32Array header (see Slot), the
+ * frames follow. WRITE and READ are byte offsets into the data area; the
+ * ring is empty when they are equal and always leaves one frame free, so
+ * it is never completely full. The capture thread is the only writer of
+ * WRITE, the consumer (JS, usually a worker thread) the only writer of
+ * READ. Every access to the header is sequentially consistent like the
+ * JS Atomics, so a consumer that sets WAITING before it checks WRITE a
+ * last time and calls Atomics.wait is never missed.
+ */
+class SharedRing
+{
+public:
+    enum Slot
+    {
+        SLOT_WRITE = 0,
+        SLOT_READ = 1,
+        SLOT_WAITING = 2,
+        SLOT_DROPPED = 3,
+        SLOT_FRAME_BYTES = 4,
+        SLOT_RATE = 5,
+        SLOT_CHANNELS = 6,
+        SLOT_SAMPLE_TYPE = 7,
+        SLOT_CAPACITY = 8,
+        SLOT_STATE = 10
+    };
+
+    enum State
+    {
+        STATE_IDLE = 0,
+        STATE_RUNNING = 1,
+        STATE_CLOSED = 2
+    };
+
+    static const size_t header_bytes = 64;
+
+    SharedRing() : base(NULL), bytes(0), capacity(0), frame_bytes(0) {}
+
+    /* base points to bytes bytes of the SharedArrayBuffer; the header is cleared */
+    SharedRing(char *base, size_t bytes) : base(base), bytes(bytes), capacity(0), frame_bytes(0)
+    {
+        memset(base, 0, header_bytes);
+    }
+
+    bool active() const
+    {
+        return base != NULL;
+    }
+
+    /* fixes the capacity to a multiple of frame_bytes on the first call; later calls (reopen) only update the format */
+    void configure(size_t frame_size, unsigned int rate, size_t channels, int sample_type)
+    {
+        if (capacity == 0)
+        {
+            frame_bytes = frame_size;
+            // the offsets are Int32
+            size_t room = bytes - header_bytes < 0x7fffffff ? bytes - header_bytes : 0x7fffffff;
+            capacity = room / frame_bytes * frame_bytes;
+            store(SLOT_CAPACITY, static_cast<int32_t>(capacity));
+            store(SLOT_FRAME_BYTES, static_cast<int32_t>(frame_bytes));
+        }
+        store(SLOT_RATE, static_cast<int32_t>(rate));
+        store(SLOT_CHANNELS, static_cast<int32_t>(channels));
+        store(SLOT_SAMPLE_TYPE, sample_type);
+        store(SLOT_STATE, STATE_RUNNING);
+    }
+
+    /* most bytes a single write() can ever take */
+    size_t room() const
+    {
+        return capacity > frame_bytes ? capacity - frame_bytes : 0;
+    }
+
+    /* copies size bytes (whole frames) in, or nothing and counts them as dropped if they do not fit */
+    bool write(const char *src, size_t size)
+    {
+        size_t w = static_cast<size_t>(load(SLOT_WRITE));
+        size_t r = static_cast<size_t>(load(SLOT_READ));
+        size_t used = w >= r ? w - r : capacity - r + w;
+
+        if (r >= capacity || used + size > room())
+        {
+            add(SLOT_DROPPED, static_cast<int32_t>(size / frame_bytes));
+            return false;
+        }
+
+        char *data = base + header_bytes;
+        size_t first = size < capacity - w ? size : capacity - w;
+        memcpy(data + w, src, first);
+        memcpy(data, src + first, size - first);
+
+        w += size;
+        store(SLOT_WRITE, static_cast<int32_t>(w >= capacity ? w - capacity : w));
+        return true;
+    }
+
+    /* whether the consumer announced it is (about to be) blocked in Atomics.wait */
+    bool consumerWaiting() const
+    {
+        return load(SLOT_WAITING) != 0;
+    }
+
+    void close()
+    {
+        if (active())
+        {
+            store(SLOT_STATE, STATE_CLOSED);
+        }
+    }
+
+private:
+    int32_t *slot(Slot s) const
+    {
+        return reinterpret_cast<int32_t *>(base) + s;
+    }
+
+    int32_t load(Slot s) const
+    {
+        return __atomic_load_n(slot(s), __ATOMIC_SEQ_CST);
+    }
+
+    void store(Slot s, int32_t value)
+    {
+        __atomic_store_n(slot(s), value, __ATOMIC_SEQ_CST);
+    }
+
+    void add(Slot s, int32_t value)
+    {
+        __atomic_fetch_add(slot(s), value, __ATOMIC_SEQ_CST);
+    }
+
+    char *base;
+    size_t bytes;
+    // bytes of the data area in use, a multiple of frame_bytes
+    size_t capacity;
+    size_t frame_bytes;
+};
+
+#endif // ____SharedRing__
@@ -0,0 +1,115 @@
+#ifndef ____SilenceGate__
+#define ____SilenceGate__
+
+#include <stdint.h>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include "level-meter.h"
+
+/*
+ * Energy gate for the gate option. The frames are measured in blocks; a
+ * block whose mean square over all channels reaches the threshold is loud.
+ * The first loud block opens the gate, which closes again once no block has
+ * been loud for hangover frames. Positions are frame numbers as in the
+ * audio events.
+ */
+class SilenceGate
+{
+public:
+    enum Event
+    {
+        GATE_NONE,
+        GATE_OPENED,
+        GATE_CLOSED
+    };
+
+    SilenceGate() : threshold(0), hangover(0), open(false), block_position(0), last_loud(0), trigger_position(0) {}
+
+    SilenceGate(size_t channels, size_t block, SampleOutput input, double threshold_db, uint64_t hangover)
+        : meter(channels, block, input), threshold(std::pow(10.0, threshold_db / 10.0)), hangover(hangover), open(false),
+          block_position(0), last_loud(0), trigger_position(0) {}
+
+    bool active() const
+    {
+        return meter.active();
+    }
+
+    bool isOpen() const
+    {
+        return open;
+    }
+
+    /* first frame of the block that opened the gate */
+    uint64_t trigger() const
+    {
+        return trigger_position;
+    }
+
+    /* measures frames frames starting at position; returns whether the gate opened or closed on them */
+    Event process(const char *data, size_t frames, size_t frame_bytes, uint64_t position)
+    {
+        Event event = GATE_NONE;
+
+        while (frames > 0)
+        {
+            if (meter.frames() == 0)
+            {
+                block_position = position;
+            }
+
+            size_t n = meter.add(data, frames);
+            data += n * frame_bytes;
+            frames -= n;
+            position += n;
+
+            if (meter.complete())
+            {
+                meter.take(rms, peak, clipped);
+
+                double power = 0.0;
+                for (double value : rms)
+                {
+                    power += value * value;
+                }
+                power /= rms.size();
+
+                if (power >= threshold)
+                {
+                    last_loud = position;
+                    if (!open)
+                    {
+                        open = true;
+                        trigger_position = block_position;
+                        event = GATE_OPENED;
+                    }
+                }
+            }
+        }
+
+        if (open && event != GATE_OPENED && position - last_loud > hangover)
+        {
+            open = false;
+            event = GATE_CLOSED;
+        }
+        return event;
+    }
+
+private:
+    LevelMeter meter;
+    // mean square at the threshold
+    double threshold;
+    uint64_t hangover;
+    bool open;
+    uint64_t block_position;
+    // end of the last loud block
+    uint64_t last_loud;
+    uint64_t trigger_position;
+    // levels of the last block, kept to not allocate per block
+    std::vector<double> rms;
+    std::vector<double> peak;
+    std::vector<double> clipped;
+};
+
+#endif // ____SilenceGate__
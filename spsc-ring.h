@@ -0,0 +1,120 @@
+#ifndef ____SpscRing__
+#define ____SpscRing__
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+/*
+ * Bounded lock-free single-producer/single-consumer ring.
+ *
+ * Exactly one thread may call push() and exactly one (other) thread may call
+ * pop() and peek(). The capacity is rounded up to a power of two so indices
+ * wrap with a mask. Head and tail live on their own cache lines, and each
+ * side keeps a cached copy of the other side's index so the shared line is
+ * only touched when the ring looks full (producer) or empty (consumer).
+ *
+ * T must be cheap to copy; the ring stores values, not pointers to them.
+ */
+template <typename T>
+class SpscRing
+{
+public:
+    explicit SpscRing(size_t capacity)
+        : mask(roundUp(capacity) - 1), slots(mask + 1), head(0), cached_tail(0), tail(0), cached_head(0)
+    {
+    }
+
+    /* producer side; returns false if the ring is full */
+    bool push(const T &value)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+
+        if (t - cached_head > mask)
+        {
+            cached_head = head.load(std::memory_order_acquire);
+            if (t - cached_head > mask)
+            {
+                return false;
+            }
+        }
+
+        slots[t & mask] = value;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    /* consumer side; returns false if the ring is empty */
+    bool pop(T &value)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+
+        if (h == cached_tail)
+        {
+            cached_tail = tail.load(std::memory_order_acquire);
+            if (h == cached_tail)
+            {
+                return false;
+            }
+        }
+
+        value = slots[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    /* consumer side: copies the oldest element without removing it; returns false if the ring is empty */
+    bool peek(T &value)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+
+        if (h == cached_tail)
+        {
+            cached_tail = tail.load(std::memory_order_acquire);
+            if (h == cached_tail)
+            {
+                return false;
+            }
+        }
+
+        value = slots[h & mask];
+        return true;
+    }
+
+    /* approximate when called concurrently with push/pop */
+    size_t size() const
+    {
+        size_t t = tail.load(std::memory_order_acquire);
+        size_t h = head.load(std::memory_order_acquire);
+        return t - h;
+    }
+
+    size_t capacity() const
+    {
+        return mask + 1;
+    }
+
+private:
+    static size_t roundUp(size_t n)
+    {
+        size_t p = 1;
+        while (p < n)
+        {
+            p <<= 1;
+        }
+        return p;
+    }
+
+    const size_t mask;
+    std::vector<T> slots;
+
+    // consumer line: its index plus its copy of the producer's
+    alignas(64) std::atomic<size_t> head;
+    size_t cached_tail;
+
+    // producer line
+    alignas(64) std::atomic<size_t> tail;
+    size_t cached_head;
+};
+
+#endif // ____SpscRing__
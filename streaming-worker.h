@@ -31,6 +31,18 @@ SOFTWARE.
 #include <mutex>
 #include <chrono>
 #include <condition_variable>
+#include <system_error>
+#include <atomic>
+#include <memory>
+#include <set>
+#include <vector>
+
+#include "buffer-pool.h"
+#include "capture-stats.h"
+#include "message.h"
+#include "pc-queue.h"
+#include "sample-convert.h"
+#include "spsc-ring.h"
 
 DISABLE_WCAST_FUNCTION_TYPE
 #include <nan.h>
@@ -39,78 +51,208 @@ DISABLE_WCAST_FUNCTION_TYPE_END
 using namespace Nan;
 using namespace std;
 
-template <typename Data>
-class PCQueue
+// fixed layout metadata of an audio chunk, delivered to JS as the batch object
+struct ChunkMeta
 {
-public:
-  void write(Data data)
-  {
-    while (true)
-    {
-      std::unique_lock<std::mutex> locker(mu);
-      buffer_.push_back(data);
-      locker.unlock();
-      cond.notify_all();
-      return;
-    }
-  }
-  Data read()
-  {
-    while (true)
-    {
-      std::unique_lock<std::mutex> locker(mu);
-      cond.wait(locker, [this]() { return buffer_.size() > 0; });
-      Data back = buffer_.front();
-      buffer_.pop_front();
-      locker.unlock();
-      cond.notify_all();
-      return back;
-    }
-  }
-  void readAll(std::deque<Data> &target)
-  {
-    std::unique_lock<std::mutex> locker(mu);
-    std::copy(buffer_.begin(), buffer_.end(), std::back_inserter(target));
-    buffer_.clear();
-    locker.unlock();
-  }
-  PCQueue() {}
+  // CLOCK_MONOTONIC ns at which the first frame was captured
+  int64_t timestamp;
+  // running count of the frames read from the device before the first frame
+  uint64_t position;
+  // snd_pcm_delay in frames when the chunk was handed over
+  int64_t delay;
+  // number of ALSA periods and frames concatenated in buffer
+  uint32_t periods;
+  uint32_t frames;
+  // index into the devices option, -1 for a single device capture
+  int32_t device;
+};
 
-private:
-  std::mutex mu;
-  std::condition_variable cond;
-  std::deque<Data> buffer_;
+// audio travels on a lock-free ring, so a chunk only refers to its pooled buffer
+struct AudioChunk
+{
+  BufferPool *pool;
+  char *buffer;
+  size_t size;
+  ChunkMeta meta;
+  // a SampleOutput: raw bytes, Float32 or Int16 samples
+  int sample_type;
+  // planar layout: number of channel planes (0 for interleaved), plane c
+  // starts at buffer + c * plane_stride and holds plane_size bytes
+  uint32_t planes;
+  size_t plane_stride;
+  size_t plane_size;
+  // CLOCK_MONOTONIC ns at which the newest frame was captured, 0 if unknown
+  int64_t captured;
 };
 
-class Message
+// what writeAudioToNode does with a chunk that does not fit the queue limits
+enum QueuePolicy
 {
-public:
-  string name;
-  string data;
-  string binary;
-  Message(string name, string data, string binary) : name(name), data(data), binary(binary) {}
+  QUEUE_DROP_NEWEST,
+  QUEUE_DROP_OLDEST,
+  QUEUE_BLOCK
 };
 
-class StreamingWorker : public AsyncProgressWorker
+/*
+ * Runs Execute on its own native thread (not on the libuv threadpool) and
+ * forwards everything it writes to the JS thread through a uv_async_t.
+ *
+ * The worker is owned by its StreamWorkerWrapper: it is deleted once the
+ * wrapper is gone and the async handle is closed, so methods on the JS object
+ * stay safe after the capture finished.
+ */
+class StreamingWorker
 {
 public:
+  class ExecutionProgress
+  {
+  public:
+    explicit ExecutionProgress(StreamingWorker *worker) : worker(worker) {}
+
+    // wakes the JS thread; many signals may be coalesced into one drain
+    void Signal() const
+    {
+      worker->signal();
+    }
+
+  private:
+    StreamingWorker *worker;
+  };
+
   StreamingWorker(
       Callback *progress,
       Callback *callback,
       Callback *error_callback)
-      : AsyncProgressWorker(callback), progress(progress), error_callback(error_callback)
+      : progress(progress), callback(callback), error_callback(error_callback)
   {
     input_closed = false;
+    input_paused = false;
+    audio_enabled = true;
+    flowing = true;
+    audio_dropped = 0;
+    queue_max_frames = 0;
+    queue_max_bytes = 0;
+    queue_limited = false;
+    queue_policy.store(QUEUE_DROP_NEWEST, std::memory_order_relaxed);
+    queued_frames = 0;
+    queued_bytes = 0;
+    queued_frames_high = 0;
+    queued_bytes_high = 0;
+    dropped_frames = 0;
+    dropped_frames_total = 0;
+    finished = false;
+    started = false;
+    completed = false;
+    handle_closed = false;
+    released = false;
+
+    // reused for every dispatch instead of being created per message
+    message_resource = new Nan::AsyncResource("streaming-worker:message");
+    audio_event.Reset(New<v8::String>("audio").ToLocalChecked());
+    dropped_event.Reset(New<v8::String>("dropped").ToLocalChecked());
+    empty_string.Reset(New<v8::String>("").ToLocalChecked());
+    periods_key.Reset(New<v8::String>("periods").ToLocalChecked());
+    frames_key.Reset(New<v8::String>("frames").ToLocalChecked());
+    device_key.Reset(New<v8::String>("device").ToLocalChecked());
+    timestamp_key.Reset(New<v8::String>("timestamp").ToLocalChecked());
+    position_key.Reset(New<v8::String>("position").ToLocalChecked());
+    delay_key.Reset(New<v8::String>("delay").ToLocalChecked());
   }
 
-  ~StreamingWorker()
+  virtual ~StreamingWorker()
   {
-    delete progress;
-    delete error_callback;
+    // give back pooled buffers that never made it to JS
+    AudioChunk chunk;
+    for (auto &ring : audio)
+    {
+      while (ring->pop(chunk))
+      {
+        chunk.pool->release(chunk.buffer);
+      }
+    }
+
+    for (BufferPool *p : pools)
+    {
+      p->destroy();
+    }
+
+    audio_event.Reset();
+    dropped_event.Reset();
+    empty_string.Reset();
+    periods_key.Reset();
+    frames_key.Reset();
+    device_key.Reset();
+    timestamp_key.Reset();
+    position_key.Reset();
+    delay_key.Reset();
+    delete message_resource;
+
+    releaseCallbacks();
+  }
+
+  virtual void Execute(const ExecutionProgress &progress) = 0;
+
+  // starts the capture thread; called once from the JS thread
+  void Start()
+  {
+    async.data = this;
+    uv_async_init(GetCurrentEventLoop(), &async, AsyncProgress);
+    started = true;
+
+    try
+    {
+      thread = std::thread(&StreamingWorker::Run, this);
+    }
+    catch (const std::system_error &e)
+    {
+      SetErrorMessage(e.what());
+      finished = true;
+      uv_async_send(&async);
+    }
+  }
+
+  // called by the owning wrapper when it is garbage collected
+  void Release()
+  {
+    released = true;
+    close();
+
+    if (!started || handle_closed)
+    {
+      delete this;
+    }
+  }
+
+  // the environment (main thread or worker thread) is torn down: the capture thread is stopped and joined before
+  // the loop goes away and nothing calls into JS any more; the worker is deleted once its handle is closed
+  void Shutdown()
+  {
+    released = true;
+    close();
+
+    if (!started || handle_closed)
+    {
+      delete this;
+      return;
+    }
+
+    // otherwise WorkProgress already joined the thread and closes the handle
+    if (!completed)
+    {
+      completed = true;
+      if (thread.joinable())
+      {
+        thread.join();
+      }
+      releaseCallbacks();
+      uv_close(reinterpret_cast<uv_handle_t *>(&async), AsyncClosed);
+    }
   }
 
   void HandleErrorCallback()
   {
+    // what was queued before the error still goes out first
+    drainQueue();
     HandleScope scope;
 
     v8::Local<v8::Value> argv[] = {
@@ -127,23 +269,174 @@ public:
     callback->Call(0, NULL, &async_resource);
   }
 
-  void HandleProgressCallback(const char *data, size_t size)
+  void close()
+  {
+    input_closed = true;
+    wake();
+  }
+
+  // pause() keeps the device configured, so resuming is immediate
+  void pause(bool paused)
   {
-    drainQueue();
+    input_paused = paused;
+    wake();
   }
 
-  void close()
+  // with audio disabled the producer keeps capturing but does not hand audio to JS
+  void enableAudio(bool enabled)
   {
-    input_closed = true;
+    audio_enabled = enabled;
+  }
+
+  // flow control of a stream: paused, audio stays queued natively (within the queue limits) until JS asks for more
+  void setFlowing(bool enabled)
+  {
+    bool resumed = enabled && !flowing;
+    flowing = enabled;
+    if (resumed && !completed)
+    {
+      signal();
+    }
+  }
+
+  // a stream's highWaterMark (bytes) bounds the audio queued while it is paused, unless maxQueuedFrames/maxQueuedBytes are set
+  void limitStream(uint64_t max_bytes)
+  {
+    if (!queue_limited)
+    {
+      queue_max_bytes = max_bytes;
+    }
+  }
+
+  // the audio the producer kept of a device: { data, from, to }, or undefined if it keeps none
+  virtual v8::Local<v8::Value> history(double from, double to, int device)
+  {
+    return Undefined();
+  }
+
+  // fills target with size/available/exhausted summed over all buffer pools (zeros before a device is configured)
+  void poolStats(v8::Local<v8::Object> target)
+  {
+    double size = 0, available = 0, exhausted = 0;
+    {
+      std::lock_guard<std::mutex> locker(pools_mu);
+      for (BufferPool *p : pools)
+      {
+        size += p->size();
+        available += p->available();
+        exhausted += p->exhausted();
+      }
+    }
+    Nan::Set(target, New("size").ToLocalChecked(), New<v8::Number>(size));
+    Nan::Set(target, New("available").ToLocalChecked(), New<v8::Number>(available));
+    Nan::Set(target, New("exhausted").ToLocalChecked(), New<v8::Number>(exhausted));
+  }
+
+  // fills target with the frames/bytes queued for JS right now, their high-water marks and the frames dropped so far
+  void queueStats(v8::Local<v8::Object> target)
+  {
+    Nan::Set(target, New("frames").ToLocalChecked(), New<v8::Number>(static_cast<double>(queued_frames.load(std::memory_order_relaxed))));
+    Nan::Set(target, New("bytes").ToLocalChecked(), New<v8::Number>(static_cast<double>(queued_bytes.load(std::memory_order_relaxed))));
+    Nan::Set(target, New("highWaterFrames").ToLocalChecked(), New<v8::Number>(static_cast<double>(queued_frames_high.load(std::memory_order_relaxed))));
+    Nan::Set(target, New("highWaterBytes").ToLocalChecked(), New<v8::Number>(static_cast<double>(queued_bytes_high.load(std::memory_order_relaxed))));
+    Nan::Set(target, New("droppedFrames").ToLocalChecked(), New<v8::Number>(static_cast<double>(dropped_frames_total.load(std::memory_order_relaxed))));
+  }
+
+  // fills target with the capture counters, the queue state and the capture to dispatch latency (ms)
+  void stats(v8::Local<v8::Object> target)
+  {
+    Nan::Set(target, New("periods").ToLocalChecked(), New<v8::Number>(CaptureCounters::get(counters.periods)));
+    Nan::Set(target, New("frames").ToLocalChecked(), New<v8::Number>(CaptureCounters::get(counters.frames)));
+    Nan::Set(target, New("overruns").ToLocalChecked(), New<v8::Number>(CaptureCounters::get(counters.overruns)));
+    Nan::Set(target, New("shortReads").ToLocalChecked(), New<v8::Number>(CaptureCounters::get(counters.short_reads)));
+    Nan::Set(target, New("readErrors").ToLocalChecked(), New<v8::Number>(CaptureCounters::get(counters.read_errors)));
+    Nan::Set(target, New("chunksDelivered").ToLocalChecked(), New<v8::Number>(CaptureCounters::get(counters.chunks_delivered)));
+    Nan::Set(target, New("bytesDelivered").ToLocalChecked(), New<v8::Number>(CaptureCounters::get(counters.bytes_delivered)));
+    Nan::Set(target, New("queuedFrames").ToLocalChecked(), New<v8::Number>(CaptureCounters::get(queued_frames)));
+    Nan::Set(target, New("queuedBytes").ToLocalChecked(), New<v8::Number>(CaptureCounters::get(queued_bytes)));
+    Nan::Set(target, New("highWaterFrames").ToLocalChecked(), New<v8::Number>(CaptureCounters::get(queued_frames_high)));
+    Nan::Set(target, New("highWaterBytes").ToLocalChecked(), New<v8::Number>(CaptureCounters::get(queued_bytes_high)));
+    Nan::Set(target, New("droppedFrames").ToLocalChecked(), New<v8::Number>(CaptureCounters::get(dropped_frames_total)));
+
+    v8::Local<v8::Object> histogram = New<v8::Object>();
+    double count = static_cast<double>(latency.count);
+    Nan::Set(histogram, New("count").ToLocalChecked(), New<v8::Number>(count));
+    Nan::Set(histogram, New("min").ToLocalChecked(), New<v8::Number>(latency.min / 1000.0));
+    Nan::Set(histogram, New("mean").ToLocalChecked(), New<v8::Number>(count > 0 ? latency.total / count / 1000.0 : 0));
+    Nan::Set(histogram, New("p50").ToLocalChecked(), New<v8::Number>(latency.percentile(0.5) / 1000.0));
+    Nan::Set(histogram, New("p90").ToLocalChecked(), New<v8::Number>(latency.percentile(0.9) / 1000.0));
+    Nan::Set(histogram, New("p99").ToLocalChecked(), New<v8::Number>(latency.percentile(0.99) / 1000.0));
+    Nan::Set(histogram, New("p999").ToLocalChecked(), New<v8::Number>(latency.percentile(0.999) / 1000.0));
+    Nan::Set(histogram, New("max").ToLocalChecked(), New<v8::Number>(latency.max / 1000.0));
+    Nan::Set(target, New("latency").ToLocalChecked(), histogram);
   }
 
   PCQueue<Message> fromNode;
 
 protected:
-  void writeToNode(const AsyncProgressWorker::ExecutionProgress &progress, const Message &msg)
+  void writeToNode(const ExecutionProgress &progress, const Message &msg)
   {
     toNode.write(msg);
-    progress.Send(reinterpret_cast<const char *>(&toNode), sizeof(toNode));
+    progress.Signal();
+  }
+
+  // fast path for audio: no lock, no allocation; returns false (and keeps the
+  // buffer with the caller) if JS has fallen too far behind and the chunk was
+  // dropped. Beyond the queue limits the queue policy decides what is dropped.
+  // Every producing thread must use its own ring.
+  bool writeAudioToNode(const ExecutionProgress &progress, const AudioChunk &chunk, size_t ring = 0)
+  {
+    // drop-oldest queues whatever fits into the ring, the consumer trims the queue back to the limits (trimQueue)
+    QueuePolicy policy = queue_policy.load(std::memory_order_relaxed);
+    bool limited = policy != QUEUE_DROP_OLDEST;
+    if (policy == QUEUE_BLOCK)
+    {
+      // not reading lets ALSA overrun, which is reported as usual
+      while (overQueueLimit(chunk) && !closed())
+      {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    }
+
+    if ((limited && overQueueLimit(chunk)) || !audio[ring]->push(chunk))
+    {
+      audio_dropped.fetch_add(1, std::memory_order_relaxed);
+      dropFrames(progress, chunk.meta.frames);
+      return false;
+    }
+
+    updateHighWater(queued_frames_high, queued_frames.fetch_add(chunk.meta.frames, std::memory_order_relaxed) + chunk.meta.frames);
+    updateHighWater(queued_bytes_high, queued_bytes.fetch_add(chunk.size, std::memory_order_relaxed) + chunk.size);
+    progress.Signal();
+    return true;
+  }
+
+  // counts frames that never reached JS; reported by the next "dropped" event
+  void dropFrames(const ExecutionProgress &progress, uint64_t frames)
+  {
+    dropped_frames.fetch_add(frames, std::memory_order_relaxed);
+    dropped_frames_total.fetch_add(frames, std::memory_order_relaxed);
+    progress.Signal();
+  }
+
+  // 0 means no limit; must be called before the worker is started
+  void setQueueLimits(uint64_t max_frames, uint64_t max_bytes, QueuePolicy policy)
+  {
+    queue_max_frames = max_frames;
+    queue_max_bytes = max_bytes;
+    queue_policy.store(policy, std::memory_order_relaxed);
+    queue_limited = max_frames > 0 || max_bytes > 0;
+  }
+
+  // must be called from the subclass constructor, before the worker is started;
+  // one ring per thread that writes audio
+  void initAudioQueue(size_t capacity, size_t rings = 1)
+  {
+    audio.clear();
+    for (size_t i = 0; i < rings; i++)
+    {
+      audio.emplace_back(new SpscRing<AudioChunk>(capacity));
+    }
   }
 
   bool closed()
@@ -151,10 +444,270 @@ protected:
     return input_closed;
   }
 
+  bool paused()
+  {
+    return input_paused;
+  }
+
+  bool audioEnabled()
+  {
+    return audio_enabled.load(std::memory_order_relaxed);
+  }
+
+  // called from the JS thread after close() and pause(): gets the producer out of a blocking wait
+  virtual void wake() {}
+
+  // called on the JS thread at the end of every drain, for audio handed to JS other than through events
+  virtual void drained() {}
+
+  // creates a pool audio buffers are read into; called from Execute once the period size is known.
+  // Pools stay alive until the worker is deleted.
+  BufferPool *createPool(size_t count, size_t size)
+  {
+    BufferPool *p = new BufferPool(count, size);
+    std::lock_guard<std::mutex> locker(pools_mu);
+    pools.push_back(p);
+    return p;
+  }
+
+  // drops a pool that was replaced by a new one (after the period size changed);
+  // it is deleted once JS gave back all of its buffers
+  void retirePool(BufferPool *p)
+  {
+    {
+      std::lock_guard<std::mutex> locker(pools_mu);
+      pools.erase(std::remove(pools.begin(), pools.end(), p), pools.end());
+    }
+    p->destroy();
+  }
+
+  void SetErrorMessage(const char *message)
+  {
+    error_message = message;
+  }
+
+  const char *ErrorMessage() const
+  {
+    return error_message.c_str();
+  }
+
   Callback *progress;
+  Callback *callback;
   Callback *error_callback;
   PCQueue<Message> toNode;
-  bool input_closed;
+  std::vector<std::unique_ptr<SpscRing<AudioChunk>>> audio;
+  std::atomic<uint64_t> audio_dropped;
+  std::atomic<bool> input_closed;
+  std::atomic<bool> input_paused;
+  std::atomic<bool> audio_enabled;
+
+  // queue limits and what is queued for JS right now (over all rings); a stream may set the byte limit later
+  std::atomic<uint64_t> queue_max_frames;
+  std::atomic<uint64_t> queue_max_bytes;
+  // a subscriber capture turns block into drop-newest from its thread (it must not stall the reader)
+  std::atomic<QueuePolicy> queue_policy;
+  bool queue_limited;
+  std::atomic<uint64_t> queued_frames;
+  std::atomic<uint64_t> queued_bytes;
+  std::atomic<uint64_t> queued_frames_high;
+  std::atomic<uint64_t> queued_bytes_high;
+  // frames dropped since the last "dropped" event, and in total
+  std::atomic<uint64_t> dropped_frames;
+  std::atomic<uint64_t> dropped_frames_total;
+
+  CaptureCounters counters;
+  // capture to dispatch time of every audio chunk, JS thread only
+  LatencyHistogram latency;
+  std::mutex pools_mu;
+  std::vector<BufferPool *> pools;
+
+private:
+  // a chunk is always accepted into an empty queue, so limits below one batch still deliver audio
+  bool overQueueLimit(const AudioChunk &chunk) const
+  {
+    uint64_t frames = queued_frames.load(std::memory_order_relaxed);
+    uint64_t bytes = queued_bytes.load(std::memory_order_relaxed);
+    uint64_t max_frames = queue_max_frames.load(std::memory_order_relaxed);
+    uint64_t max_bytes = queue_max_bytes.load(std::memory_order_relaxed);
+
+    if (frames == 0)
+    {
+      return false;
+    }
+    return (max_frames > 0 && frames + chunk.meta.frames > max_frames) ||
+           (max_bytes > 0 && bytes + chunk.size > max_bytes);
+  }
+
+  // the queue holds more than its limits allow (drop-oldest only)
+  bool overQueueLimit() const
+  {
+    uint64_t max_frames = queue_max_frames.load(std::memory_order_relaxed);
+    uint64_t max_bytes = queue_max_bytes.load(std::memory_order_relaxed);
+
+    return (max_frames > 0 && queued_frames.load(std::memory_order_relaxed) > max_frames) ||
+           (max_bytes > 0 && queued_bytes.load(std::memory_order_relaxed) > max_bytes);
+  }
+
+  // drop-oldest: drops the oldest chunks of all rings until the queue is within its limits again, the newest
+  // one is always kept. Runs on the JS thread as the consumer of the rings, so the buffers go back with release()
+  void trimQueue()
+  {
+    if (queue_policy.load(std::memory_order_relaxed) != QUEUE_DROP_OLDEST)
+    {
+      return;
+    }
+
+    while (overQueueLimit())
+    {
+      SpscRing<AudioChunk> *oldest_ring = NULL;
+      AudioChunk oldest, chunk;
+      for (auto &ring : audio)
+      {
+        if (ring->peek(chunk) && (oldest_ring == NULL || chunk.meta.timestamp < oldest.meta.timestamp))
+        {
+          oldest_ring = ring.get();
+          oldest = chunk;
+        }
+      }
+      if (oldest_ring == NULL || queued_frames.load(std::memory_order_relaxed) <= oldest.meta.frames)
+      {
+        return;
+      }
+
+      oldest_ring->pop(oldest);
+      dequeued(oldest);
+      dropped_frames.fetch_add(oldest.meta.frames, std::memory_order_relaxed);
+      dropped_frames_total.fetch_add(oldest.meta.frames, std::memory_order_relaxed);
+      oldest.pool->release(oldest.buffer);
+    }
+  }
+
+  void dequeued(const AudioChunk &chunk)
+  {
+    queued_frames.fetch_sub(chunk.meta.frames, std::memory_order_relaxed);
+    queued_bytes.fetch_sub(chunk.size, std::memory_order_relaxed);
+  }
+
+  static void updateHighWater(std::atomic<uint64_t> &high, uint64_t value)
+  {
+    uint64_t current = high.load(std::memory_order_relaxed);
+    while (value > current && !high.compare_exchange_weak(current, value, std::memory_order_relaxed))
+    {
+    }
+  }
+
+  void Run()
+  {
+    ExecutionProgress progress(this);
+    Execute(progress);
+
+    finished = true;
+    uv_async_send(&async);
+  }
+
+  void signal()
+  {
+    uv_async_send(&async);
+  }
+
+  static void AsyncProgress(uv_async_t *handle)
+  {
+    static_cast<StreamingWorker *>(handle->data)->WorkProgress();
+  }
+
+  static void AsyncClosed(uv_handle_t *handle)
+  {
+    StreamingWorker *worker = static_cast<StreamingWorker *>(handle->data);
+    worker->handle_closed = true;
+
+    if (worker->released)
+    {
+      delete worker;
+    }
+  }
+
+  void WorkProgress()
+  {
+    HandleScope scope;
+
+    // read before draining, everything written before finishing is drained below
+    bool done = finished;
+    if (completed)
+    {
+      return;
+    }
+    if (!done)
+    {
+      drainQueue();
+      return;
+    }
+
+    completed = true;
+    thread.join();
+
+    if (error_message.empty())
+    {
+      HandleOKCallback();
+    }
+    else
+    {
+      HandleErrorCallback();
+    }
+
+    // the callbacks keep the JS object alive, drop them so it can be collected
+    releaseCallbacks();
+    uv_close(reinterpret_cast<uv_handle_t *>(&async), AsyncClosed);
+  }
+
+  void releaseCallbacks()
+  {
+    delete progress;
+    delete callback;
+    delete error_callback;
+    progress = NULL;
+    callback = NULL;
+    error_callback = NULL;
+  }
+
+  uv_async_t async;
+  std::thread thread;
+  std::string error_message;
+  std::atomic<bool> finished;
+  bool started;
+  bool completed;
+  bool handle_closed;
+  bool released;
+  // JS thread only, see setFlowing()
+  bool flowing;
+
+  Nan::AsyncResource *message_resource;
+  Nan::Persistent<v8::String> audio_event;
+  Nan::Persistent<v8::String> dropped_event;
+  Nan::Persistent<v8::String> empty_string;
+  Nan::Persistent<v8::String> periods_key;
+  Nan::Persistent<v8::String> frames_key;
+  Nan::Persistent<v8::String> device_key;
+  Nan::Persistent<v8::String> timestamp_key;
+  Nan::Persistent<v8::String> position_key;
+  Nan::Persistent<v8::String> delay_key;
+
+protected:
+  // a typed array matching sample_type over size bytes of buffer, starting at offset
+  static v8::Local<v8::Value> sampleView(v8::Local<v8::Object> buffer, size_t offset, size_t size, int sample_type)
+  {
+    v8::Local<v8::Uint8Array> bytes = buffer.As<v8::Uint8Array>();
+    offset += bytes->ByteOffset();
+
+    switch (sample_type)
+    {
+    case SAMPLE_OUTPUT_F32:
+      return v8::Float32Array::New(bytes->Buffer(), offset, size / sizeof(float));
+    case SAMPLE_OUTPUT_S16:
+      return v8::Int16Array::New(bytes->Buffer(), offset, size / sizeof(int16_t));
+    default:
+      return v8::Uint8Array::New(bytes->Buffer(), offset, size);
+    }
+  }
 
 private:
   void drainQueue()
@@ -170,24 +723,135 @@ private:
       auto eventName = New<v8::String>(msg.name.c_str()).ToLocalChecked();
       auto eventMessage = New<v8::String>(msg.data.c_str()).ToLocalChecked();
 
-      if (msg.binary.length() > 0)
+      // (name, data[, payload[, device]]), payload being an object, a Buffer or undefined
+      v8::Local<v8::Value> payload = Undefined();
+      if (!msg.fields.empty())
       {
-        v8::Local<v8::Value> argv[] = {
-            eventName,
-            eventMessage,
-            CopyBuffer(&msg.binary[0], msg.binary.length()).ToLocalChecked()};
-        Nan::AsyncResource async_resource("streaming-worker:binary-message");
-        progress->Call(3, argv, &async_resource);
+        v8::Local<v8::Object> object = New<v8::Object>();
+        for (MessageField &field : msg.fields)
+        {
+          v8::Local<v8::Value> value;
+          switch (field.type)
+          {
+          case MessageField::BOOLEAN:
+            value = New<v8::Boolean>(field.number != 0);
+            break;
+          case MessageField::STRING:
+            value = New<v8::String>(field.text).ToLocalChecked();
+            break;
+          case MessageField::ARRAY:
+          {
+            v8::Local<v8::Array> array = New<v8::Array>(static_cast<int>(field.values.size()));
+            for (size_t i = 0; i < field.values.size(); i++)
+            {
+              Nan::Set(array, static_cast<uint32_t>(i), New<v8::Number>(field.values[i]));
+            }
+            value = array;
+            break;
+          }
+          default:
+            value = New<v8::Number>(field.number);
+          }
+          Nan::Set(object, New<v8::String>(field.key).ToLocalChecked(), value);
+        }
+        payload = object;
       }
-      else
+      else if (msg.binary.length() > 0)
       {
+        payload = CopyBuffer(&msg.binary[0], msg.binary.length()).ToLocalChecked();
+      }
+
+      v8::Local<v8::Value> argv[] = {
+          eventName,
+          eventMessage,
+          payload,
+          New<v8::Number>(msg.device)};
+      int argc = msg.device >= 0 ? 4 : (payload->IsUndefined() ? 2 : 3);
+      progress->Call(argc, argv, message_resource);
+    }
+
+    v8::Local<v8::String> audioEvent = New(audio_event);
+    v8::Local<v8::String> emptyString = New(empty_string);
+
+    trimQueue();
+
+    // one event for everything dropped since the last drain, before the audio that is left
+    uint64_t dropped = dropped_frames.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0)
+    {
+      v8::Local<v8::Value> argv[] = {
+          New(dropped_event),
+          emptyString,
+          New<v8::Number>(static_cast<double>(dropped))};
+      progress->Call(3, argv, message_resource);
+    }
+
+    v8::Local<v8::String> periodsKey = New(periods_key);
+    v8::Local<v8::String> framesKey = New(frames_key);
+    v8::Local<v8::String> deviceKey = New(device_key);
+    v8::Local<v8::String> timestampKey = New(timestamp_key);
+    v8::Local<v8::String> positionKey = New(position_key);
+    v8::Local<v8::String> delayKey = New(delay_key);
+
+    int64_t now = monotonic_ns();
+
+    // a paused stream leaves the audio queued; the last drain delivers everything as nothing comes after it
+    AudioChunk chunk;
+    for (auto &ring : audio)
+    {
+      while ((flowing || completed) && ring->pop(chunk))
+      {
+        HandleScope chunkScope;
+        dequeued(chunk);
+
+        CaptureCounters::add(counters.chunks_delivered);
+        CaptureCounters::add(counters.bytes_delivered, chunk.size);
+        if (chunk.captured > 0)
+        {
+          latency.record((now - chunk.captured) / 1000);
+        }
+
+        v8::Local<v8::Object> batch = New<v8::Object>();
+        Nan::Set(batch, periodsKey, New<v8::Number>(chunk.meta.periods));
+        Nan::Set(batch, framesKey, New<v8::Number>(chunk.meta.frames));
+        // ms on the process.hrtime() clock
+        Nan::Set(batch, timestampKey, New<v8::Number>(chunk.meta.timestamp / 1e6));
+        Nan::Set(batch, positionKey, New<v8::Number>(static_cast<double>(chunk.meta.position)));
+        Nan::Set(batch, delayKey, New<v8::Number>(static_cast<double>(chunk.meta.delay)));
+        if (chunk.meta.device >= 0)
+        {
+          Nan::Set(batch, deviceKey, New<v8::Number>(chunk.meta.device));
+        }
+
+        // the buffer goes back to the pool when V8 finalizes it
+        v8::Local<v8::Object> buffer = NewBuffer(chunk.buffer, chunk.size, BufferPool::FreeCallback, chunk.pool).ToLocalChecked();
+        v8::Local<v8::Value> data = buffer;
+        if (chunk.planes > 0)
+        {
+          // one view per channel, all into the same pooled buffer
+          v8::Local<v8::Array> planes = New<v8::Array>(chunk.planes);
+          for (uint32_t c = 0; c < chunk.planes; c++)
+          {
+            Nan::Set(planes, c, sampleView(buffer, c * chunk.plane_stride, chunk.plane_size, chunk.sample_type));
+          }
+          data = planes;
+        }
+        else if (chunk.sample_type != SAMPLE_OUTPUT_RAW)
+        {
+          // converted samples are handed out as a typed array view of the same memory
+          data = sampleView(buffer, 0, chunk.size, chunk.sample_type);
+        }
+
         v8::Local<v8::Value> argv[] = {
-            eventName,
-            eventMessage};
-        Nan::AsyncResource async_resource("streaming-worker:message");
-        progress->Call(2, argv, &async_resource);
+            audioEvent,
+            emptyString,
+            data,
+            batch};
+        progress->Call(4, argv, message_resource);
       }
     }
+
+    drained();
   }
 };
 
@@ -198,21 +862,67 @@ class StreamWorkerWrapper : public Nan::ObjectWrap
 public:
   static NAN_MODULE_INIT(Init)
   {
-    v8::Local<v8::FunctionTemplate> tpl = Nan::New<v8::FunctionTemplate>(New);
+    // the constructor is kept in the data of New instead of a static, every context (worker thread) gets its own
+    v8::Local<v8::Object> data = Nan::New<v8::Object>();
+    v8::Local<v8::FunctionTemplate> tpl = Nan::New<v8::FunctionTemplate>(New, data);
     tpl->SetClassName(Nan::New("StreamingWorker").ToLocalChecked());
     tpl->InstanceTemplate()->SetInternalFieldCount(2);
 
     // SetPrototypeMethod(tpl, "sendToAddon", sendToAddon);
     SetPrototypeMethod(tpl, "closeInput", closeInput);
+    SetPrototypeMethod(tpl, "pauseInput", pauseInput);
+    SetPrototypeMethod(tpl, "resumeInput", resumeInput);
+    SetPrototypeMethod(tpl, "poolStats", poolStats);
+    SetPrototypeMethod(tpl, "queueStats", queueStats);
+    SetPrototypeMethod(tpl, "stats", stats);
+    SetPrototypeMethod(tpl, "getHistory", getHistory);
+    SetPrototypeMethod(tpl, "setEmitAudio", setEmitAudio);
+    SetPrototypeMethod(tpl, "setFlowing", setFlowing);
+
+    v8::Local<v8::Function> cons = Nan::GetFunction(tpl).ToLocalChecked();
+    Nan::Set(data, 0, cons);
+
+    // the live instances of this environment, stopped by Cleanup when it exits
+    Instances *instances = new Instances();
+    Nan::Set(data, 1, Nan::New<v8::External>(instances));
+    node::AddEnvironmentCleanupHook(v8::Isolate::GetCurrent(), Cleanup, instances);
 
-    constructor().Reset(Nan::GetFunction(tpl).ToLocalChecked());
-    Nan::Set(target, Nan::New("StreamingWorker").ToLocalChecked(),
-             Nan::GetFunction(tpl).ToLocalChecked());
+    Nan::Set(target, Nan::New("StreamingWorker").ToLocalChecked(), cons);
   }
 
 private:
-  explicit StreamWorkerWrapper(StreamingWorker *worker) : _worker(worker) {}
-  ~StreamWorkerWrapper() {}
+  typedef std::set<StreamWorkerWrapper *> Instances;
+
+  StreamWorkerWrapper(StreamingWorker *worker, Instances *instances) : _worker(worker), _instances(instances)
+  {
+    _instances->insert(this);
+  }
+
+  ~StreamWorkerWrapper()
+  {
+    if (_instances)
+    {
+      _instances->erase(this);
+    }
+    if (_worker)
+    {
+      _worker->Release();
+    }
+  }
+
+  // environment cleanup hook: a worker thread may exit (or the process shut down) while captures still run, and
+  // their threads must not signal a loop that is gone
+  static void Cleanup(void *arg)
+  {
+    Instances *instances = static_cast<Instances *>(arg);
+    for (StreamWorkerWrapper *wrapper : *instances)
+    {
+      wrapper->_worker->Shutdown();
+      wrapper->_worker = NULL;
+      wrapper->_instances = NULL;
+    }
+    delete instances;
+  }
 
   static NAN_METHOD(New)
   {
@@ -254,23 +964,26 @@ private:
         options = v8::Object::New(isolate);
       }
 
+      Instances *instances = static_cast<Instances *>(
+          Nan::Get(info.Data().As<v8::Object>(), 1).ToLocalChecked().As<v8::External>()->Value());
       StreamWorkerWrapper *obj = new StreamWorkerWrapper(
           create_worker(
               data_callback,
               complete_callback,
-              error_callback, options));
+              error_callback, options),
+          instances);
 
       obj->Wrap(info.This());
       info.GetReturnValue().Set(info.This());
 
-      // start the worker
-      AsyncQueueWorker(obj->_worker);
+      // start the capture thread
+      obj->_worker->Start();
     }
     else
     {
-      const int argc = 3;
-      v8::Local<v8::Value> argv[argc] = {info[0], info[1], info[2]};
-      v8::Local<v8::Function> cons = Nan::New(constructor());
+      const int argc = 4;
+      v8::Local<v8::Value> argv[argc] = {info[0], info[1], info[2], info[3]};
+      v8::Local<v8::Function> cons = Nan::Get(info.Data().As<v8::Object>(), 0).ToLocalChecked().As<v8::Function>();
       v8::Local<v8::Object> instance = Nan::NewInstance(cons, argc, argv).ToLocalChecked();
       info.GetReturnValue().Set(instance);
     }
@@ -289,12 +1002,71 @@ private:
     obj->_worker->close();
   }
 
-  static inline Nan::Persistent<v8::Function> &constructor()
+  static NAN_METHOD(pauseInput)
+  {
+    StreamWorkerWrapper *obj = Nan::ObjectWrap::Unwrap<StreamWorkerWrapper>(info.Holder());
+    obj->_worker->pause(true);
+  }
+
+  static NAN_METHOD(resumeInput)
   {
-    static Nan::Persistent<v8::Function> my_constructor;
-    return my_constructor;
+    StreamWorkerWrapper *obj = Nan::ObjectWrap::Unwrap<StreamWorkerWrapper>(info.Holder());
+    obj->_worker->pause(false);
+  }
+
+  static NAN_METHOD(poolStats)
+  {
+    StreamWorkerWrapper *obj = Nan::ObjectWrap::Unwrap<StreamWorkerWrapper>(info.Holder());
+    v8::Local<v8::Object> stats = Nan::New<v8::Object>();
+    obj->_worker->poolStats(stats);
+    info.GetReturnValue().Set(stats);
+  }
+
+  static NAN_METHOD(queueStats)
+  {
+    StreamWorkerWrapper *obj = Nan::ObjectWrap::Unwrap<StreamWorkerWrapper>(info.Holder());
+    v8::Local<v8::Object> stats = Nan::New<v8::Object>();
+    obj->_worker->queueStats(stats);
+    info.GetReturnValue().Set(stats);
+  }
+
+  static NAN_METHOD(stats)
+  {
+    StreamWorkerWrapper *obj = Nan::ObjectWrap::Unwrap<StreamWorkerWrapper>(info.Holder());
+    v8::Local<v8::Object> stats = Nan::New<v8::Object>();
+    obj->_worker->stats(stats);
+    info.GetReturnValue().Set(stats);
+  }
+
+  // getHistory(fromFrame, toFrame?, device?)
+  static NAN_METHOD(getHistory)
+  {
+    StreamWorkerWrapper *obj = Nan::ObjectWrap::Unwrap<StreamWorkerWrapper>(info.Holder());
+    double from = info[0]->IsNumber() ? Nan::To<double>(info[0]).FromJust() : 0;
+    double to = info[1]->IsNumber() ? Nan::To<double>(info[1]).FromJust() : -1;
+    int device = info[2]->IsNumber() ? Nan::To<int>(info[2]).FromJust() : 0;
+    info.GetReturnValue().Set(obj->_worker->history(from, to, device));
+  }
+
+  static NAN_METHOD(setEmitAudio)
+  {
+    StreamWorkerWrapper *obj = Nan::ObjectWrap::Unwrap<StreamWorkerWrapper>(info.Holder());
+    obj->_worker->enableAudio(info[0]->IsTrue());
+  }
+
+  // setFlowing(enabled, highWaterMarkBytes?)
+  static NAN_METHOD(setFlowing)
+  {
+    StreamWorkerWrapper *obj = Nan::ObjectWrap::Unwrap<StreamWorkerWrapper>(info.Holder());
+    if (info[1]->IsNumber())
+    {
+      double limit = Nan::To<double>(info[1]).FromJust();
+      obj->_worker->limitStream(limit > 0 ? static_cast<uint64_t>(limit) : 0);
+    }
+    obj->_worker->setFlowing(info[0]->IsTrue());
   }
 
   StreamingWorker *_worker;
+  Instances *_instances;
 };
 #endif // ____StreamingWorker__
@@ -0,0 +1,269 @@
+/*
+ * Every SIMD kernel of sample-convert.h against the scalar path, which
+ * defines the exact result: the output has to be bit identical for edge
+ * values (full scale, INT_MIN, clipping, NaN, 24 bit sign extension) and
+ * for every tail length. Input and output are allocated at their exact
+ * size, so building with -fsanitize=address also catches kernels that read
+ * or write past the end.
+ */
+#include <stdint.h>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include "sample-convert.h"
+
+using namespace sample_convert;
+
+struct Kernel
+{
+    const char *name;
+    snd_pcm_format_t format;
+    SampleOutput output;
+    ConvertKernel kernel;
+    bool (*supported)();
+};
+
+static bool always()
+{
+    return true;
+}
+
+static const Kernel kernels[] = {
+#ifdef SAMPLE_CONVERT_X86
+    {"sse2 S16_LE f32", SND_PCM_FORMAT_S16_LE, SAMPLE_OUTPUT_F32, sse2_s16le_f32, has_sse2},
+    {"sse2 S32_LE f32", SND_PCM_FORMAT_S32_LE, SAMPLE_OUTPUT_F32, sse2_s32le_f32<0>, has_sse2},
+    {"sse2 S24_LE f32", SND_PCM_FORMAT_S24_LE, SAMPLE_OUTPUT_F32, sse2_s32le_f32<8>, has_sse2},
+    {"sse2 S32_LE s16", SND_PCM_FORMAT_S32_LE, SAMPLE_OUTPUT_S16, sse2_s32le_s16<0>, has_sse2},
+    {"sse2 S24_LE s16", SND_PCM_FORMAT_S24_LE, SAMPLE_OUTPUT_S16, sse2_s32le_s16<8>, has_sse2},
+    {"sse2 FLOAT_LE s16", SND_PCM_FORMAT_FLOAT_LE, SAMPLE_OUTPUT_S16, sse2_f32le_s16, has_sse2},
+    {"avx2 S16_LE f32", SND_PCM_FORMAT_S16_LE, SAMPLE_OUTPUT_F32, avx2_s16le_f32, has_avx2},
+    {"avx2 S32_LE f32", SND_PCM_FORMAT_S32_LE, SAMPLE_OUTPUT_F32, avx2_s32le_f32<0>, has_avx2},
+    {"avx2 S24_LE f32", SND_PCM_FORMAT_S24_LE, SAMPLE_OUTPUT_F32, avx2_s32le_f32<8>, has_avx2},
+    {"avx2 S24_3LE f32", SND_PCM_FORMAT_S24_3LE, SAMPLE_OUTPUT_F32, avx2_s24_3le_f32, has_avx2},
+    {"avx2 S24_3LE s16", SND_PCM_FORMAT_S24_3LE, SAMPLE_OUTPUT_S16, avx2_s24_3le_s16, has_avx2},
+#endif
+#ifdef SAMPLE_CONVERT_NEON
+    {"neon S16_LE f32", SND_PCM_FORMAT_S16_LE, SAMPLE_OUTPUT_F32, neon_s16le_f32, always},
+    {"neon S32_LE f32", SND_PCM_FORMAT_S32_LE, SAMPLE_OUTPUT_F32, neon_s32le_f32<0>, always},
+    {"neon S24_LE f32", SND_PCM_FORMAT_S24_LE, SAMPLE_OUTPUT_F32, neon_s32le_f32<8>, always},
+    {"neon S32_LE s16", SND_PCM_FORMAT_S32_LE, SAMPLE_OUTPUT_S16, neon_s32le_s16<0>, always},
+    {"neon S24_LE s16", SND_PCM_FORMAT_S24_LE, SAMPLE_OUTPUT_S16, neon_s32le_s16<8>, always},
+#endif
+    {"scalar S16_LE f32", SND_PCM_FORMAT_S16_LE, SAMPLE_OUTPUT_F32, scalar_s16le_f32, always},
+    {"scalar S32_LE f32", SND_PCM_FORMAT_S32_LE, SAMPLE_OUTPUT_F32, scalar_s32le_f32, always},
+    {"scalar S24_LE f32", SND_PCM_FORMAT_S24_LE, SAMPLE_OUTPUT_F32, scalar_s24le_f32, always},
+    {"scalar S24_3LE f32", SND_PCM_FORMAT_S24_3LE, SAMPLE_OUTPUT_F32, scalar_s24_3le_f32, always},
+    {"scalar S32_LE s16", SND_PCM_FORMAT_S32_LE, SAMPLE_OUTPUT_S16, scalar_s32le_s16, always},
+    {"scalar S24_LE s16", SND_PCM_FORMAT_S24_LE, SAMPLE_OUTPUT_S16, scalar_s24le_s16, always},
+    {"scalar S24_3LE s16", SND_PCM_FORMAT_S24_3LE, SAMPLE_OUTPUT_S16, scalar_s24_3le_s16, always},
+    {"scalar FLOAT_LE s16", SND_PCM_FORMAT_FLOAT_LE, SAMPLE_OUTPUT_S16, scalar_f32le_s16, always},
+};
+
+/* xorshift, so every run checks the same samples */
+static uint32_t next_random(uint32_t &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+static void put32(std::vector<unsigned char> &bytes, size_t i, uint32_t value)
+{
+    memcpy(&bytes[i * 4], &value, 4);
+}
+
+static uint32_t float_bits(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, 4);
+    return bits;
+}
+
+/* samples samples of format: the edge values first (repeated, so they also land in the SIMD part), random ones after */
+static std::vector<unsigned char> make_input(snd_pcm_format_t format, size_t samples, uint32_t seed)
+{
+    static const int16_t s16_edges[] = {0, 1, -1, 32767, -32768, 16384, -16384};
+    static const uint32_t s32_edges[] = {0, 1, 0xffffffffu, 0x7fffffffu, 0x80000000u, 0x00010000u, 0xffff0000u, 0x00008000u};
+    // S24_LE in 32 bits: only the low 24 bits count, whatever is in the top byte
+    static const uint32_t s24_edges[] = {0, 0x007fffffu, 0x00800000u, 0x00ffffffu, 0xff7fffffu, 0x12800000u, 0x7f000000u, 0x80000001u};
+    // S24_3LE: max, min, -1, 1, and a sample whose sign bit is the top bit of the last byte only
+    static const unsigned char s24_3_edges[][3] = {{0xff, 0xff, 0x7f}, {0x00, 0x00, 0x80}, {0xff, 0xff, 0xff}, {0x01, 0x00, 0x00}, {0x00, 0x80, 0x80}};
+    const float f32_edges[] = {0.0f, -0.0f, 1.0f, -1.0f, 1.5f, -1.5f, 0.99999f, -1.00001f,
+                               0.5f / 32768.0f, 1.5f / 32768.0f, 2.5f / 32768.0f, -0.5f / 32768.0f, 32767.5f / 32768.0f,
+                               std::numeric_limits<float>::quiet_NaN(), -std::numeric_limits<float>::quiet_NaN(),
+                               std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(),
+                               FLT_MAX, -FLT_MAX, FLT_MIN / 2};
+
+    FormatInfo info = format_info(format);
+    std::vector<unsigned char> bytes(samples * info.physical_bytes);
+    uint32_t state = seed;
+
+    for (size_t i = 0; i < samples; i++)
+    {
+        bool edge = i < 3 * 20;
+        uint32_t random = next_random(state);
+        switch (format)
+        {
+        case SND_PCM_FORMAT_S16_LE:
+        {
+            int16_t value = edge ? s16_edges[i % 7] : static_cast<int16_t>(random);
+            memcpy(&bytes[i * 2], &value, 2);
+            break;
+        }
+        case SND_PCM_FORMAT_S32_LE:
+            put32(bytes, i, edge ? s32_edges[i % 8] : random);
+            break;
+        case SND_PCM_FORMAT_S24_LE:
+            put32(bytes, i, edge ? s24_edges[i % 8] : random);
+            break;
+        case SND_PCM_FORMAT_S24_3LE:
+            if (edge)
+            {
+                memcpy(&bytes[i * 3], s24_3_edges[i % 5], 3);
+            }
+            else
+            {
+                memcpy(&bytes[i * 3], &random, 3);
+            }
+            break;
+        case SND_PCM_FORMAT_FLOAT_LE:
+        {
+            // random ones mostly around full scale, where clipping and rounding happen
+            float value = static_cast<float>(static_cast<int32_t>(random)) / 1.5e9f;
+            put32(bytes, i, float_bits(edge ? f32_edges[i % 20] : value));
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    return bytes;
+}
+
+static bool check(const Kernel &k, size_t samples, uint32_t seed)
+{
+    FormatInfo info = format_info(k.format);
+    size_t out_bytes = k.output == SAMPLE_OUTPUT_F32 ? 4 : 2;
+    std::vector<unsigned char> input = make_input(k.format, samples, seed);
+    std::vector<unsigned char> expected(samples * out_bytes);
+    std::vector<unsigned char> actual(samples * out_bytes);
+
+    const char *src = reinterpret_cast<const char *>(input.data());
+    if (k.output == SAMPLE_OUTPUT_F32)
+    {
+        scalar_to_f32(src, reinterpret_cast<char *>(expected.data()), samples, info);
+    }
+    else
+    {
+        scalar_to_s16(src, reinterpret_cast<char *>(expected.data()), samples, info);
+    }
+    k.kernel(src, reinterpret_cast<char *>(actual.data()), samples);
+
+    for (size_t i = 0; i < samples; i++)
+    {
+        if (memcmp(&expected[i * out_bytes], &actual[i * out_bytes], out_bytes) != 0)
+        {
+            if (k.output == SAMPLE_OUTPUT_F32)
+            {
+                float e, a;
+                memcpy(&e, &expected[i * 4], 4);
+                memcpy(&a, &actual[i * 4], 4);
+                fprintf(stderr, "FAIL %s: %zu samples, sample %zu is %.9g instead of %.9g\n", k.name, samples, i, a, e);
+            }
+            else
+            {
+                int16_t e, a;
+                memcpy(&e, &expected[i * 2], 2);
+                memcpy(&a, &actual[i * 2], 2);
+                fprintf(stderr, "FAIL %s: %zu samples, sample %zu is %d instead of %d\n", k.name, samples, i, a, e);
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+/* the converter picks a kernel by format and CPU; whichever it is, the result is that of the scalar path */
+static bool check_selected(snd_pcm_format_t format, SampleOutput output, size_t samples)
+{
+    SampleConverter converter(format, output);
+    Kernel k = {converter.kernelName(), format, output, NULL, always};
+    FormatInfo info = format_info(format);
+    size_t out_bytes = output == SAMPLE_OUTPUT_F32 ? 4 : 2;
+    std::vector<unsigned char> input = make_input(format, samples, 7);
+    std::vector<unsigned char> expected(samples * out_bytes);
+    std::vector<unsigned char> actual(samples * out_bytes);
+
+    const char *src = reinterpret_cast<const char *>(input.data());
+    if (output == SAMPLE_OUTPUT_F32)
+    {
+        scalar_to_f32(src, reinterpret_cast<char *>(expected.data()), samples, info);
+    }
+    else
+    {
+        scalar_to_s16(src, reinterpret_cast<char *>(expected.data()), samples, info);
+    }
+    converter.convert(src, reinterpret_cast<char *>(actual.data()), samples);
+
+    if (memcmp(expected.data(), actual.data(), expected.size()) != 0)
+    {
+        fprintf(stderr, "FAIL selected kernel %s for %s: differs from the scalar path\n", k.name, snd_pcm_format_name(format));
+        return false;
+    }
+    return true;
+}
+
+int main()
+{
+    int failed = 0;
+    int run = 0;
+
+    for (const Kernel &k : kernels)
+    {
+        if (!k.supported())
+        {
+            printf("skip %s (not supported by this CPU)\n", k.name);
+            continue;
+        }
+
+        // every tail length of the widest kernel, then sizes of real periods
+        std::vector<size_t> lengths;
+        for (size_t n = 0; n <= 67; n++)
+        {
+            lengths.push_back(n);
+        }
+        lengths.push_back(1023);
+        lengths.push_back(4096);
+        lengths.push_back(4099);
+
+        bool ok = true;
+        for (size_t n : lengths)
+        {
+            ok = check(k, n, static_cast<uint32_t>(n) * 2654435761u + 1) && ok;
+        }
+        printf("%s %s\n", ok ? "ok  " : "FAIL", k.name);
+        failed += ok ? 0 : 1;
+        run++;
+    }
+
+    const snd_pcm_format_t formats[] = {SND_PCM_FORMAT_S16_LE, SND_PCM_FORMAT_S24_LE, SND_PCM_FORMAT_S32_LE,
+                                        SND_PCM_FORMAT_S24_3LE, SND_PCM_FORMAT_FLOAT_LE};
+    for (snd_pcm_format_t format : formats)
+    {
+        for (SampleOutput output : {SAMPLE_OUTPUT_F32, SAMPLE_OUTPUT_S16})
+        {
+            bool ok = check_selected(format, output, 1027);
+            failed += ok ? 0 : 1;
+            run++;
+        }
+    }
+
+    printf("convert-test: %d of %d checks passed\n", run - failed, run);
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,135 @@
+/*
+ * The planar transposes of deinterleave.h against a transpose one sample at
+ * a time: the SSE2 stereo paths, the blocked scalar paths for every sample
+ * size and deinterleave_frames itself, for 1, 2 and odd channel counts and
+ * every tail length. Input and planes are allocated at their exact size, so
+ * building with -fsanitize=address also catches paths that read or write
+ * past the end.
+ */
+#include <stdint.h>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "deinterleave.h"
+
+using namespace deinterleave;
+
+typedef void (*Transpose)(const char *src, char *dst, size_t frames, size_t channels, size_t plane_stride);
+
+struct Path
+{
+    const char *name;
+    size_t sample_bytes;
+    // 0 for any
+    size_t channels;
+    Transpose transpose;
+    bool (*supported)();
+};
+
+static bool always()
+{
+    return true;
+}
+
+static const Path paths[] = {
+#ifdef DEINTERLEAVE_X86
+    {"sse2 stereo 32 bit", 4, 2, [](const char *src, char *dst, size_t frames, size_t, size_t stride) { stereo32(src, dst, frames, stride); }, has_sse2},
+    {"sse2 stereo 16 bit", 2, 2, [](const char *src, char *dst, size_t frames, size_t, size_t stride) { stereo16(src, dst, frames, stride); }, has_sse2},
+#endif
+    {"blocked 8 bit", 1, 0, blocked<uint8_t>, always},
+    {"blocked 16 bit", 2, 0, blocked<uint16_t>, always},
+    {"blocked 32 bit", 4, 0, blocked<uint32_t>, always},
+    {"blocked 64 bit", 8, 0, blocked<uint64_t>, always},
+    {"blocked 24 bit", 3, 0, [](const char *src, char *dst, size_t frames, size_t channels, size_t stride) { blocked_bytes(src, dst, frames, channels, stride, 3); }, always},
+    {"selected 16 bit", 2, 0, [](const char *src, char *dst, size_t frames, size_t channels, size_t stride) { deinterleave_frames(src, dst, frames, channels, 2, stride); }, always},
+    {"selected 24 bit", 3, 0, [](const char *src, char *dst, size_t frames, size_t channels, size_t stride) { deinterleave_frames(src, dst, frames, channels, 3, stride); }, always},
+    {"selected 32 bit", 4, 0, [](const char *src, char *dst, size_t frames, size_t channels, size_t stride) { deinterleave_frames(src, dst, frames, channels, 4, stride); }, always},
+};
+
+/* xorshift, so every run checks the same samples */
+static uint32_t next_random(uint32_t &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+static bool check(const Path &p, size_t channels, size_t frames, uint32_t seed)
+{
+    size_t bytes = p.sample_bytes;
+    size_t stride = frames * bytes;
+    std::vector<char> input(frames * channels * bytes);
+    for (char &b : input)
+    {
+        b = static_cast<char>(next_random(seed));
+    }
+
+    std::vector<char> expected(channels * stride);
+    for (size_t i = 0; i < frames; i++)
+    {
+        for (size_t c = 0; c < channels; c++)
+        {
+            memcpy(&expected[c * stride + i * bytes], &input[(i * channels + c) * bytes], bytes);
+        }
+    }
+
+    std::vector<char> actual(channels * stride);
+    p.transpose(input.data(), actual.data(), frames, channels, stride);
+
+    for (size_t c = 0; c < channels; c++)
+    {
+        for (size_t i = 0; i < frames; i++)
+        {
+            if (memcmp(&expected[c * stride + i * bytes], &actual[c * stride + i * bytes], bytes) != 0)
+            {
+                fprintf(stderr, "FAIL %s: %zu channels, %zu frames, channel %zu frame %zu differs\n", p.name, channels, frames, c, i);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int main()
+{
+    int failed = 0;
+    int run = 0;
+
+    for (const Path &p : paths)
+    {
+        if (!p.supported())
+        {
+            printf("skip %s (not supported by this CPU)\n", p.name);
+            continue;
+        }
+
+        // every tail length of the SIMD paths and around a block, then a real period
+        std::vector<size_t> lengths;
+        for (size_t n = 0; n <= 67; n++)
+        {
+            lengths.push_back(n);
+        }
+        lengths.push_back(1023);
+
+        bool ok = true;
+        for (size_t channels : {1, 2, 3, 5})
+        {
+            if (p.channels != 0 && channels != p.channels)
+            {
+                continue;
+            }
+            for (size_t n : lengths)
+            {
+                ok = check(p, channels, n, static_cast<uint32_t>(n * 8 + channels) * 2654435761u + 1) && ok;
+            }
+        }
+        printf("%s %s\n", ok ? "ok  " : "FAIL", p.name);
+        failed += ok ? 0 : 1;
+        run++;
+    }
+
+    printf("deinterleave-test: %d of %d checks passed\n", run - failed, run);
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,166 @@
+/*
+ * What reading a period costs with rw access (snd_pcm_readi into a scratch
+ * buffer, then converting) against mmap access (converting straight out of
+ * the DMA area with readMapped), the two paths of readConverted, and what
+ * mmap saves, for 1 to 16 channels. Only the read itself is timed, the wait
+ * for the period is not.
+ *
+ * Needs a capture device: the first argument or ALSA_BENCH_DEVICE, "null"
+ * by default, which works without any sound card (hw:X,Y gives the real
+ * numbers). A channel count the device refuses is skipped with a note.
+ */
+#include <stdint.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "pcm-device.h"
+#include "sample-convert.h"
+
+static const int periods = 1000;
+
+/* PcmDevice::open does not fail on a channel count the device refuses, it gets the nearest one */
+static bool supports(const std::string &device, unsigned int channels)
+{
+    snd_pcm_t *handle;
+    if (snd_pcm_open(&handle, device.c_str(), SND_PCM_STREAM_CAPTURE, 0) < 0)
+    {
+        return true; // open() reports why
+    }
+    snd_pcm_hw_params_t *params;
+    snd_pcm_hw_params_alloca(&params);
+    snd_pcm_hw_params_any(handle, params);
+    bool ok = snd_pcm_hw_params_test_channels(handle, params, channels) == 0;
+    snd_pcm_close(handle);
+    return ok;
+}
+
+/* median ns a period of channels channels takes to read, or -1 if the device cannot be read that way */
+static int64_t run(const std::string &device, unsigned int channels, bool mmap, const char *name)
+{
+    PcmConfig config;
+    config.device = device;
+    config.channels = channels;
+    config.format = SND_PCM_FORMAT_S16_LE;
+    config.rate = 48000;
+    config.period_size = 256;
+    config.mmap = mmap;
+
+    PcmDevice pcm(config);
+    std::vector<Message> notices;
+    std::string error;
+    if (!pcm.open(false, false, notices, error))
+    {
+        error.erase(error.find_last_not_of('\n') + 1);
+        printf("%2u ch %-5s skipped, %s: %s\n", channels, name, device.c_str(), error.c_str());
+        return -1;
+    }
+    if (pcm.mmap != mmap)
+    {
+        printf("%2u ch %-5s skipped, %s refuses mmap access\n", channels, name, device.c_str());
+        return -1;
+    }
+
+    SampleConverter converter(config.format, SAMPLE_OUTPUT_F32);
+    size_t samples = config.channels;
+    size_t out_frame_bytes = samples * converter.outputBytes();
+    std::vector<char> scratch(pcm.period_bytes);
+    std::vector<char> dst(pcm.frames * out_frame_bytes);
+    std::vector<int64_t> times;
+
+    int rc = pcm.start();
+    for (int i = 0; rc >= 0 && i < periods; i++)
+    {
+        // the wait for the period is not part of the read
+        int ready = snd_pcm_wait(pcm.handle, 1000);
+        if (ready == 0)
+        {
+            rc = -ETIMEDOUT;
+            break;
+        }
+        if (ready < 0)
+        {
+            rc = pcm.recover(ready);
+            i--;
+            continue;
+        }
+        snd_pcm_sframes_t avail = snd_pcm_avail_update(pcm.handle);
+        if (avail >= 0 && static_cast<snd_pcm_uframes_t>(avail) < pcm.frames)
+        {
+            i--;
+            continue;
+        }
+
+        int64_t start = monotonic_ns();
+        snd_pcm_sframes_t n;
+        if (mmap)
+        {
+            char *out = dst.data();
+            n = pcm.readMapped(pcm.frames, [&converter, out, samples, out_frame_bytes](const char *src, snd_pcm_uframes_t offset, snd_pcm_uframes_t frames) {
+                converter.convert(src, out + offset * out_frame_bytes, frames * samples);
+            });
+        }
+        else
+        {
+            n = pcm.read(scratch.data(), pcm.frames);
+            if (n > 0)
+            {
+                converter.convert(scratch.data(), dst.data(), n * samples);
+            }
+        }
+        int64_t elapsed = monotonic_ns() - start;
+
+        if (n == -EPIPE)
+        {
+            rc = pcm.start();
+            continue;
+        }
+        if (n < 0)
+        {
+            rc = static_cast<int>(n);
+            break;
+        }
+        times.push_back(elapsed);
+    }
+    pcm.close();
+
+    if (times.empty())
+    {
+        printf("%2u ch %-5s failed: %s\n", channels, name, snd_strerror(rc));
+        return -1;
+    }
+
+    std::sort(times.begin(), times.end());
+    int64_t median = times[times.size() / 2];
+    printf("%2u ch %-5s %6.1f ns/frame  period of %lu frames: median %7ld ns  p99 %7ld ns  (%zu periods, kernel %s)\n", channels,
+           name, static_cast<double>(median) / pcm.frames, pcm.frames, static_cast<long>(median),
+           static_cast<long>(times[times.size() * 99 / 100]), times.size(), converter.kernelName());
+    return median;
+}
+
+int main(int argc, char **argv)
+{
+    const char *env = getenv("ALSA_BENCH_DEVICE");
+    std::string device = argc > 1 ? argv[1] : env ? env : "null";
+    printf("device %s\n", device.c_str());
+
+    const unsigned int counts[] = {1, 2, 8, 16};
+    for (unsigned int channels : counts)
+    {
+        if (!supports(device, channels))
+        {
+            printf("%2u ch skipped, %s refuses %u channels\n", channels, device.c_str(), channels);
+            continue;
+        }
+        int64_t rw = run(device, channels, false, "rw");
+        int64_t mmap = run(device, channels, true, "mmap");
+        if (rw > 0 && mmap >= 0)
+        {
+            printf("%2u ch mmap saves %ld ns per period (%.0f%%)\n", channels, static_cast<long>(rw - mmap),
+                   100.0 * (rw - mmap) / rw);
+        }
+    }
+    return 0;
+}
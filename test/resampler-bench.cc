@@ -0,0 +1,133 @@
+/*
+ * Throughput of the resampler: every dot product kernel of resampler.h the
+ * CPU supports against the scalar one at the filter lengths the presets
+ * give, then Resampler::process with the kernel it selects for common rate
+ * pairs at every quality. Reported per period of stereo Float32 input: ns
+ * per input frame and how many times faster than real time that is.
+ */
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "resampler.h"
+
+using namespace resample;
+
+static const size_t channels = 2;
+static const size_t period = 1024;
+
+static int64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool always()
+{
+    return true;
+}
+
+struct Kernel
+{
+    const char *name;
+    DotKernel kernel;
+    bool (*supported)();
+};
+
+static const Kernel kernels[] = {
+    {"scalar", dot_scalar, always},
+#ifdef SAMPLE_CONVERT_X86
+    {"sse2", dot_sse2, sample_convert::has_sse2},
+    {"avx2", dot_avx2, has_avx2_fma},
+#endif
+#ifdef SAMPLE_CONVERT_NEON
+    {"neon", dot_neon, always},
+#endif
+};
+
+// keeps the results alive so the calls are not optimized away
+static volatile float sink;
+
+static void bench_kernel(const Kernel &k, size_t taps)
+{
+    const size_t calls = 2000000;
+    std::vector<float> x(taps + 64), h(taps);
+    for (size_t i = 0; i < x.size(); i++)
+    {
+        x[i] = std::sin(0.01f * i);
+    }
+    for (size_t i = 0; i < taps; i++)
+    {
+        h[i] = 1.0f / (1 + i);
+    }
+
+    float sum = 0;
+    int64_t start = now_ns();
+    for (size_t i = 0; i < calls; i++)
+    {
+        // a different offset each call, like the filter moving along the line
+        sum += k.kernel(&x[i & 63], h.data(), taps);
+    }
+    double ns = static_cast<double>(now_ns() - start) / calls;
+    sink = sum;
+    printf("dot %-6s %4zu taps %7.2f ns  %5.2f taps/ns\n", k.name, taps, ns, taps / ns);
+}
+
+static void bench_process(unsigned int in_rate, unsigned int out_rate, ResampleQuality quality, const char *quality_name)
+{
+    const size_t periods = 2000;
+    Resampler resampler(channels, in_rate, out_rate, quality, period);
+    std::vector<float> in(period * channels);
+    std::vector<float> out(resampler.maxOutput(period) * channels);
+    for (size_t i = 0; i < period; i++)
+    {
+        for (size_t c = 0; c < channels; c++)
+        {
+            in[i * channels + c] = std::sin(0.05f * i + c);
+        }
+    }
+
+    size_t written = 0;
+    int64_t start = now_ns();
+    for (size_t i = 0; i < periods; i++)
+    {
+        written += resampler.process(in.data(), period, out.data());
+    }
+    int64_t elapsed = now_ns() - start;
+    sink = out[0];
+
+    double total = static_cast<double>(periods) * period;
+    double realtime = total / in_rate * 1e9 / elapsed;
+    printf("%6u -> %-6u %-6s %7.2f ns/frame  %6.0fx real time  (%zu frames out, %s)\n", in_rate, out_rate, quality_name,
+           elapsed / total, realtime, written, resampler.kernelName());
+}
+
+int main()
+{
+    // 16/32/64 taps of the presets, and widened 3x for 48000 -> 16000 at best
+    const size_t taps[] = {16, 32, 64, 192};
+    for (size_t t : taps)
+    {
+        for (const Kernel &k : kernels)
+        {
+            if (k.supported())
+            {
+                bench_kernel(k, t);
+            }
+        }
+    }
+
+    const unsigned int rates[][2] = {{48000, 16000}, {44100, 48000}, {48000, 44100}};
+    const ResampleQuality qualities[] = {RESAMPLE_FAST, RESAMPLE_MEDIUM, RESAMPLE_BEST};
+    const char *names[] = {"fast", "medium", "best"};
+    for (const auto &r : rates)
+    {
+        for (size_t q = 0; q < 3; q++)
+        {
+            bench_process(r[0], r[1], qualities[q], names[q]);
+        }
+    }
+    return 0;
+}
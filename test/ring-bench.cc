@@ -0,0 +1,121 @@
+/*
+ * The audio path from the capture thread to JS: SpscRing against the
+ * PCQueue it replaced. A producer hands over chunk sized values while a
+ * consumer drains them the way drainQueue does (pop() until empty, or
+ * readAll()). Reported per value: the time the producer spends handing it
+ * over (what the capture thread pays per period, median, p99 and worst) and
+ * the overall throughput.
+ */
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "pc-queue.h"
+#include "spsc-ring.h"
+
+// the size of an AudioChunk: pool, buffer, sizes and the batch metadata
+struct Chunk
+{
+    void *pool;
+    char *buffer;
+    uint64_t size;
+    uint64_t frames;
+    int64_t timestamp;
+    uint64_t position;
+    int64_t delay;
+    int64_t captured;
+};
+
+static const size_t count = 1000000;
+static const size_t capacity = 4096;
+
+static int64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct Result
+{
+    double total_ms;
+    std::vector<int32_t> push_ns;
+};
+
+static void report(const char *name, Result &result)
+{
+    std::vector<int32_t> &t = result.push_ns;
+    std::sort(t.begin(), t.end());
+    printf("%-10s %8.1f ns/chunk  push median %4d ns  p99 %6d ns  max %8d ns  (%zu chunks)\n", name,
+           result.total_ms * 1e6 / count, t[t.size() / 2], t[t.size() * 99 / 100], t.back(), count);
+}
+
+template <typename Push, typename Drain>
+static Result run(Push push, Drain drain)
+{
+    Result result;
+    result.push_ns.resize(count);
+
+    int64_t start = now_ns();
+    std::thread consumer([&]() {
+        size_t received = 0;
+        while (received < count)
+        {
+            size_t n = drain();
+            received += n;
+            if (n == 0)
+            {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    Chunk chunk = {};
+    for (size_t i = 0; i < count; i++)
+    {
+        chunk.position = i;
+        // a full ring drops the period in the addon, only the hand-over that succeeded is timed
+        int64_t before = now_ns();
+        while (!push(chunk))
+        {
+            std::this_thread::yield();
+            before = now_ns();
+        }
+        result.push_ns[i] = static_cast<int32_t>(std::min<int64_t>(now_ns() - before, INT32_MAX));
+    }
+    consumer.join();
+    result.total_ms = (now_ns() - start) / 1e6;
+    return result;
+}
+
+int main()
+{
+    SpscRing<Chunk> ring(capacity);
+    Result spsc = run([&](const Chunk &c) { return ring.push(c); },
+                      [&]() {
+                          size_t n = 0;
+                          Chunk c;
+                          while (ring.pop(c))
+                          {
+                              n++;
+                          }
+                          return n;
+                      });
+
+    PCQueue<Chunk> queue;
+    std::deque<Chunk> contents;
+    Result pcq = run([&](const Chunk &c) {
+                         queue.write(c);
+                         return true;
+                     },
+                     [&]() {
+                         contents.clear();
+                         queue.readAll(contents);
+                         return contents.size();
+                     });
+
+    report("SpscRing", spsc);
+    report("PCQueue", pcq);
+    return 0;
+}
@@ -0,0 +1,151 @@
+#ifndef ____ThreadConfig__
+#define ____ThreadConfig__
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/*
+ * Scheduling settings for the capture thread. Everything is best effort: the
+ * thread keeps running with whatever the system allowed and ThreadConfigResult
+ * tells which of the requested settings were actually granted.
+ */
+struct ThreadConfig
+{
+    ThreadConfig() : policy(-1), priority(0), set_nice(false), nice(0), lock_memory(false) {}
+
+    // -1 leaves the policy alone, otherwise SCHED_OTHER, SCHED_FIFO or SCHED_RR
+    int policy;
+    int priority;
+    bool set_nice;
+    int nice;
+    std::vector<int> cpus;
+    bool lock_memory;
+
+    bool requested() const
+    {
+        return policy >= 0 || set_nice || !cpus.empty() || lock_memory;
+    }
+};
+
+struct ThreadConfigResult
+{
+    ThreadConfigResult() : policy_granted(false), nice_granted(false), affinity_granted(false), mlock_granted(false) {}
+
+    bool policy_granted;
+    bool nice_granted;
+    bool affinity_granted;
+    bool mlock_granted;
+    // first error per setting, empty if granted or not requested
+    std::string policy_error;
+    std::string nice_error;
+    std::string affinity_error;
+    std::string mlock_error;
+};
+
+inline const char *thread_policy_name(int policy)
+{
+    switch (policy)
+    {
+    case SCHED_FIFO:
+        return "fifo";
+    case SCHED_RR:
+        return "rr";
+    case SCHED_OTHER:
+        return "other";
+    default:
+        return "unchanged";
+    }
+}
+
+/* returns SCHED_* for "fifo", "rr" or "other" and -1 for anything else */
+inline int thread_policy_from_name(const std::string &name)
+{
+    if (name == "fifo")
+    {
+        return SCHED_FIFO;
+    }
+    if (name == "rr")
+    {
+        return SCHED_RR;
+    }
+    if (name == "other")
+    {
+        return SCHED_OTHER;
+    }
+    return -1;
+}
+
+/* applies policy, nice value and affinity to the calling thread (memory locking is separate) */
+inline void apply_thread_config(const ThreadConfig &config, ThreadConfigResult &result)
+{
+    if (config.policy >= 0)
+    {
+        sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = config.policy == SCHED_OTHER ? 0 : config.priority;
+
+        int rc = pthread_setschedparam(pthread_self(), config.policy, &param);
+        result.policy_granted = rc == 0;
+        if (rc != 0)
+        {
+            result.policy_error = strerror(rc);
+        }
+    }
+
+    if (config.set_nice)
+    {
+        // on Linux the nice value is per thread when addressed by tid
+        pid_t tid = static_cast<pid_t>(syscall(SYS_gettid));
+        result.nice_granted = setpriority(PRIO_PROCESS, tid, config.nice) == 0;
+        if (!result.nice_granted)
+        {
+            result.nice_error = strerror(errno);
+        }
+    }
+
+    if (!config.cpus.empty())
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : config.cpus)
+        {
+            CPU_SET(cpu, &set);
+        }
+
+        int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        result.affinity_granted = rc == 0;
+        if (rc != 0)
+        {
+            result.affinity_error = strerror(rc);
+        }
+    }
+}
+
+/* pins memory the capture thread touches every period; may be called for several regions */
+inline void lock_thread_memory(const ThreadConfig &config, const void *addr, size_t len, ThreadConfigResult &result)
+{
+    if (!config.lock_memory || len == 0)
+    {
+        return;
+    }
+
+    if (mlock(addr, len) == 0)
+    {
+        result.mlock_granted = result.mlock_error.empty();
+    }
+    else
+    {
+        result.mlock_granted = false;
+        result.mlock_error = strerror(errno);
+    }
+}
+
+#endif // ____ThreadConfig__